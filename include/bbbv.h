@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FILE_BSW_BBBV_H
+#define FILE_BSW_BBBV_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The 3BV ("Bechtel's Board Benchmark Value") of a board is the minimum
+ * number of left-clicks needed to clear it: one per opening (a connected
+ * region of tiles without neighbouring bombs, plus its border), and one
+ * per number that doesn't border an opening.
+ *
+ * It is counted in a single pass over the rows of `tiles`. The runs of
+ * zeros in every row are merged with the ones above them in a union-find,
+ * whose labels are renumbered after every row, so it only needs memory for
+ * a few rows.
+ *
+ * The same pass can build an index of the openings: their runs of zeros
+ * are kept, and a second union-find over all openings that ever had a
+ * label joins the ones that merge further down. Revealing an opening then
+ * only sweeps its runs and their borders, instead of searching it tile by
+ * tile.
+ */
+
+struct tile;
+struct bbbv_run;
+
+// Zeros of row `y` from `start` to `end` (exclusive).
+struct bbbv_span {
+    uint32_t y, start, end;
+};
+
+// Runs of zeros of every opening, without their borders.
+struct bbbv_openings {
+    struct bbbv_span *spans;                // Ordered by row and column.
+    uint32_t *labels;                       // Opening of every span.
+    size_t n_spans, cap_spans;
+    size_t *rows;                           // [height + 1]: First span of every row.
+    uint32_t *members;                      // Spans of every opening, ordered by opening.
+    size_t *first;                          // [n_openings + 1]: First member of every opening, NULL until done.
+    bool *swept;                            // Whether an opening was revealed.
+    size_t n_openings;
+    size_t size;                            // Bytes allocated for the index.
+};
+
+// State of a count; it only needs memory for a few rows of the board.
+struct bbbv {
+    const struct tile *tiles;
+    int width, height;
+    int y;                                  // Next row to count.
+    unsigned char *rows[3];                 // Counts of the rows y-2, y-1 and y.
+    unsigned char *bombs[3];                // Bombs of the rows y-1, y and y+1.
+    unsigned char *column;                  // Bombs in the rows y-1, y and y+1 of every column.
+    unsigned char *near_zero;               // Whether a column of `rows` has a zero.
+    struct bbbv_run *runs[2];               // Runs of zeros of the rows y-1 and y.
+    size_t n_runs[2];
+    uint32_t *parent, *remap;               // Union-find of the labels.
+    uint32_t n_labels;
+    size_t n_openings, n_isolated;
+    unsigned char *counts;                  // Allocation of all rows and columns.
+    struct bbbv_run *run_rows;              // Allocation of `runs`.
+    size_t size;                            // Bytes allocated for the buffers.
+
+    // Only used while building an index.
+    struct bbbv_openings *index;
+    uint32_t *opening, *next_opening;       // Opening in the index of every label.
+    uint32_t *roots;                        // Union-find of the openings in the index.
+    size_t n_roots, cap_roots;
+
+    struct bitboard *planes;                // Or NULL.
+};
+
+// Start counting the 3BV of a board, which must not change until the count is done.
+// If `index` isn't NULL, it is filled with the openings of the board, and
+// if `planes` isn't NULL, with the bombs and zeros; it must have the size of the board.
+void bbbv_begin (struct bbbv *, const struct tile *tiles, int width, int height,
+                 struct bbbv_openings *index, struct bitboard *planes);
+
+// Count up to `budget` tiles, which is decreased by the tiles counted.
+// Returns true, once the whole board was counted.
+bool bbbv_work (struct bbbv *, size_t *budget);
+
+float bbbv_progress (const struct bbbv *);  // In [0, 1].
+size_t bbbv_result (const struct bbbv *);   // Once bbbv_work() returned true.
+void bbbv_free (struct bbbv *);             // Free the buffers; the result stays.
+
+// Opening of the zero at (x, y), or SIZE_MAX if it isn't one or the index isn't done.
+size_t bbbv_opening_at (const struct bbbv_openings *, int x, int y);
+void bbbv_openings_free (struct bbbv_openings *);
+
+#endif // FILE_BSW_BBBV_H
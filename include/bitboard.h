@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FILE_BSW_BITBOARD_H
+#define FILE_BSW_BITBOARD_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bit-planes of a board, with one bit per tile and 64 tiles per word along
+ * the rows. The bombs around a tile are counted from three words, instead
+ * of nine tiles, and a row can be searched for tiles of a kind a word at a
+ * time. The bits past the width of a row are always zero.
+ */
+
+struct bitboard {
+    uint64_t *mines;                        // Bombs.
+    uint64_t *zeros;                        // Tiles without neighbouring bombs, that aren't bombs.
+    int width, height;
+    size_t stride;                          // Words per row.
+    size_t size;                            // Bytes allocated for both planes.
+};
+
+#define bitboard_row(bb, plane, y) ((plane) + (size_t)(y) * (bb)->stride)
+
+// Give the planes the size of a board, reusing their memory if it's large enough.
+void bitboard_resize (struct bitboard *, int width, int height);
+void bitboard_free (struct bitboard *);
+
+// Set the bits of a row, where `bytes[x] == value`.
+void bitboard_pack (uint64_t *row, const unsigned char *bytes, int width, unsigned char value);
+
+// Count the bombs in the 3x3 tiles around (x, y).
+unsigned bitboard_count (const struct bitboard *, int x, int y);
+
+#endif // FILE_BSW_BITBOARD_H
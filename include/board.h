@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FILE_BSW_BOARD_H
+#define FILE_BSW_BOARD_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "bitboard.h"
+#include "layout.h"
+#include "bbbv.h"
+
+/*
+ * The board engine (libbsw): generating boards and applying moves to them.
+ * All state of a board lives in its `struct bsw_board`, so any number of
+ * boards can be played at once, each by one thread at a time. It doesn't
+ * depend on SDL.
+ */
+
+#define TILE_MAX_SIZE (1 << 20)             // Maximum width and height of a board.
+
+enum tile_status {
+    TILE_NONE,                              // The default state of a tile.
+    TILE_MARKED,                            // Clicked w/ right-click.
+    TILE_MARKED2,                           // Clicked w/ right-click twice.
+    TILE_CLICKED,                           // Clicked w/ left-click.
+};
+
+struct tile {
+    enum tile_status status;                // Status of this tile.
+    unsigned n_bombs;                       // Number of bombs in the area, once revealed.
+    bool is_bomb;                           // Is this tile a bomb?
+};
+
+// Clearing and generating a board runs in steps, so large boards don't
+// keep a thread from handling other things.
+enum bsw_job {
+    BSW_JOB_NONE,
+    BSW_JOB_CLEAR,                          // Clear all tiles.
+    BSW_JOB_PLACE,                          // Place the bombs.
+    BSW_JOB_RATE,                           // Count the 3BV of the board.
+};
+
+struct bsw_board {
+    struct tile *tiles;
+    int width, height;
+    size_t n_bombs, n_selected;
+    size_t n_flagged;                       // Number of tiles that are TILE_MARKED.
+    size_t bbbv;                            // 3BV of the board, once it is generated.
+    unsigned seed;                          // Seed of the mine layout; chosen by bsw_reset().
+    bool generated;
+    bool game_over;
+    time_t start_time, end_time;            // When the board was generated and the game ended.
+    uint64_t start_ms, end_ms;              // monotonic_ms() of the same events.
+
+    // Indices of all tiles whose status changed since the last bsw_clear_changes().
+    size_t *changes, n_changes, cap_changes;
+
+    // Only used by the engine.
+    size_t tiles_size;                      // Size of the mapping of `tiles`.
+    int tiles_fd;                           // File backing `tiles`, or -1.
+    enum bsw_job job;
+    bool job_generate;                      // Continue with placing the bombs after clearing.
+    size_t job_pos;                         // Progress of the current step.
+    struct layout layout;                   // The mines, once the board is being generated.
+    bool has_layout;
+    bool next_seed_set;                     // Use `next_seed` for the next board.
+    unsigned next_seed;
+    unsigned rand_state;                    // Source of random seeds.
+    struct bbbv rating;
+    struct bbbv_openings openings;          // Built together with the rating.
+    struct bitboard bits;                   // Bombs and zeros, also built with the rating.
+    struct bsw_pool *pool;                  // Pool of the tiles, or NULL.
+    struct bsw_board *next_free;            // Next freed board of the pool.
+
+    // Members of `openings` that the current cascade still has to sweep.
+    size_t sweep_pos, sweep_end;
+    // Tiles of a cascade without an index, whose neighbours still need to be revealed.
+    struct tile **frontier;
+    size_t frontier_head, frontier_len, frontier_cap;
+    bool revealing;
+};
+
+#define bsw_count(b)        ((size_t)(b)->width * (b)->height)
+#define bsw_index(b, t)     ((size_t)((t) - (b)->tiles))
+#define bsw_x(b, t)         ((int)(bsw_index (b, t) % (b)->width))
+#define bsw_y(b, t)         ((int)(bsw_index (b, t) / (b)->width))
+#define bsw_all_selected(b) ((b)->n_selected == bsw_count (b) - (b)->n_bombs)
+
+// Check the size of a board, returns NULL or the reason why it's invalid.
+const char *bsw_check_size (int64_t width, int64_t height, int64_t mines);
+
+// Create a board without tiles; bsw_resize() gives it its size.
+// Boards that come and go often should be taken from a pool (pool.h).
+struct bsw_board *bsw_new (void);
+void bsw_free (struct bsw_board *);         // Boards of a pool go back to it.
+
+// Check whether a board fits into the available memory, prints why it doesn't.
+bool bsw_check_memory (const struct bsw_board *, int width, int height);
+
+// Keep the tiles in a file, for boards that don't fit into the memory.
+bool bsw_map_file (struct bsw_board *, const char *path);
+
+// Change the size of the board, and start clearing it.
+bool bsw_resize (struct bsw_board *, int width, int height, size_t mines);
+
+// Start clearing the board for a new game with a new seed.
+void bsw_reset (struct bsw_board *);
+
+// Use `seed` for the next board, instead of a random one.
+void bsw_next_seed (struct bsw_board *, unsigned seed);
+
+// Start clearing the board, and placing the bombs of the layout of
+// `seed` around (x, y). They only take effect through bsw_work().
+void bsw_generate (struct bsw_board *, int x, int y);
+
+// Continue clearing or generating the board for up to `budget` tiles.
+// Returns true, once the board is ready.
+bool bsw_work (struct bsw_board *, size_t budget);
+bool bsw_busy (const struct bsw_board *);
+float bsw_progress (const struct bsw_board *); // Of the running job in [0, 1].
+
+struct tile *bsw_tile (const struct bsw_board *, int x, int y);
+
+// Check the layout of the board in O(1), even while it is being generated.
+bool bsw_is_bomb (const struct bsw_board *, int x, int y);
+
+// Count the bombs around (x, y), the board must be generated.
+unsigned bsw_count_bombs (const struct bsw_board *, int x, int y);
+
+// Reveal a tile, and start the cascade of an opening.
+void bsw_click (struct bsw_board *, struct tile *);
+// Cycle a hidden tile through TILE_MARKED, TILE_MARKED2 and TILE_NONE.
+void bsw_flag (struct bsw_board *, struct tile *);
+void bsw_set_status (struct bsw_board *, struct tile *, enum tile_status);
+
+// Reveal up to `budget` tiles of the cascade started by bsw_click().
+// Returns true, once the cascade is complete.
+bool bsw_reveal (struct bsw_board *, size_t budget);
+bool bsw_revealing (const struct bsw_board *);
+void bsw_clear_changes (struct bsw_board *);
+
+#endif // FILE_BSW_BOARD_H
@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FILE_BSW_BOT_H
+#define FILE_BSW_BOT_H
+#include <stddef.h>
+
+struct bsw_board;
+struct buffer;
+
+// Play games without a window, driven by commands on stdin.
+// Returns the exit code of the process.
+int bot_run (void);
+
+// Run the commands of all complete lines in `in` on a board, and consume them.
+// Their answers are appended to `out`. Boards with more than `max_tiles` are invalid.
+void bot_handle (struct bsw_board *, struct buffer *in, struct buffer *out, size_t max_tiles);
+
+#endif // FILE_BSW_BOT_H
@@ -19,16 +19,18 @@
 #include <stdnoreturn.h>
 #include <SDL2/SDL_pixels.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 
 #define TITLE "Billig Sweeper"
 #define GITHUB_URL "https://github.com/riscygeek/billig-sweeper"
 
-extern bool game_over;
-extern time_t start_time, end_time;
+struct bsw_board;
+
+extern struct bsw_board *board;             // The board of the game thread.
 extern bool first_launch;
 
-extern int default_n_mines;
+extern int64_t default_n_mines;
 extern int default_width;
 extern int default_height;
 extern SDL_Color default_color;
@@ -39,6 +41,9 @@ void reset_game (void);
 void load_settings (void);
 void save_settings (void);
 
+// Path of a file in the configuration directory.
+char *config_path (const char *name);
+
 noreturn void relaunch (void);
 
 #endif // FILE_BSW_H
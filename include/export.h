@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FILE_BSW_EXPORT_H
+#define FILE_BSW_EXPORT_H
+#include <SDL2/SDL_surface.h>
+#include <stdbool.h>
+#include "game.h"
+
+#define EXPORT_TILE_SIZE 16                 // Pixels per tile, as in the graphics.
+
+// Keep the pixels of the composited tile atlas for exports.
+void export_init (SDL_Surface *atlas);
+// Cancel a running export and wait for it.
+void export_quit (void);
+
+// Write `v` as a PNG into the current directory in the background.
+// Only one export runs at a time.
+bool export_start (const struct board_view *v);
+
+#endif // FILE_BSW_EXPORT_H
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FILE_BSW_GAME_H
+#define FILE_BSW_GAME_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum game_cmd_type {
+    GAME_CMD_CLICK,                         // Click on tile (x, y) with mouse button `arg`.
+    GAME_CMD_RESET,                         // Restart the current game.
+    GAME_CMD_RESIZE,                        // Start a new game with size (x, y) and `arg` mines.
+    GAME_CMD_SYNC,                          // Send the whole board to co-op client `arg`.
+    GAME_CMD_REMOTE_BOARD,                  // Replace the board with `data` (struct net_board).
+    GAME_CMD_REMOTE_DELTA,                  // Apply the tile changes in `data` (struct net_delta).
+};
+
+struct game_cmd {
+    enum game_cmd_type type;
+    int x, y;
+    int arg;
+    void *data;                             // Owned by the game thread, once queued.
+};
+
+// Immutable snapshot of the board, published by the game thread.
+struct board_view {
+    unsigned char *tiles;                   // One tile_view() per tile.
+    int width, height;
+    size_t n_bombs, n_selected, n_flagged;
+    size_t bbbv;                            // 3BV of the board, once it is generated.
+    size_t n_clicks;                        // Clicks on the tiles, only counted by the host.
+    unsigned seed;                          // Seed of the mine layout.
+    bool generated;
+    bool game_over;
+    uint64_t start_ms, end_ms;              // monotonic_ms() when the board was generated and the game ended.
+
+    // Only touched by the game thread.
+    size_t *pending;                        // Tiles changed since this buffer was last written.
+    size_t n_pending, cap_pending;
+    bool full_refresh;                      // Too many pending changes; copy everything.
+};
+
+#define view_all_selected(v) ((v)->n_selected == ((size_t)(v)->width * (v)->height - (v)->n_bombs))
+
+bool game_init (void);
+void game_quit (void);
+// Send a command from the UI; co-op clients forward it to the host,
+// spectators ignore it.
+void game_post (const struct game_cmd *);
+// Queue a command for this game thread, waiting if the queue is full.
+void game_queue (const struct game_cmd *);
+void game_click (int x, int y, int button);
+void game_resize (int width, int height, int mines);
+
+// Progress of clearing or generating the board in permille, or -1.
+int game_progress (void);
+
+// Get the latest published board. Must only be called from the main thread.
+const struct board_view *game_view (void);
+
+#endif // FILE_BSW_GAME_H
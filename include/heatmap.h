@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FILE_BSW_HEATMAP_H
+#define FILE_BSW_HEATMAP_H
+#include <stdbool.h>
+#include "game.h"
+
+#define HEATMAP_MAX_THREADS 8
+#define HEATMAP_MAX_VARS    1024            // Larger frontiers are not solved.
+#define HEATMAP_MAX_NODES   (1ull << 28)    // Give up on components with more search steps.
+
+bool heatmap_init (void);
+void heatmap_quit (void);
+void heatmap_toggle (void);
+bool heatmap_shown (void);
+
+// Solve `v` in the background, cancelling the previous computation.
+// Does nothing, unless the heatmap is shown.
+void heatmap_update (const struct board_view *v);
+
+// Get the mine probability of every tile (negative for revealed ones) of the
+// latest solved board, or NULL if it doesn't have this size.
+// Must be followed by heatmap_unlock().
+const float *heatmap_lock (int width, int height);
+void heatmap_unlock (void);
+
+#endif // FILE_BSW_HEATMAP_H
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FILE_BSW_HISTORY_H
+#define FILE_BSW_HISTORY_H
+#include <stdbool.h>
+#include <stdint.h>
+
+#define HISTORY_WON         0x01            // The game was won.
+#define HISTORY_MAX_ENTRIES 64              // Board configurations tracked by the index, including the presets.
+
+// One finished game, as stored in `history.bin`.
+struct history_record {
+    int64_t date;                           // When the game ended (seconds since the epoch).
+    uint64_t n_mines;
+    uint32_t width, height;
+    uint32_t seed;
+    uint32_t time_ms;                       // Duration of the game.
+    uint32_t flags;                         // HISTORY_*
+    uint32_t bbbv;                          // 3BV of the board, or 0 for older records.
+};
+
+struct history_stats {
+    uint64_t n_games, n_wins;
+    uint64_t total_ms;                      // Sum of the durations of all won games.
+    uint32_t best_ms;                       // Fastest win, or 0 if there is none.
+    uint32_t reserved;
+};
+
+void history_load (void);
+void history_add (const struct history_record *);
+
+// Look up the statistics of a board configuration in O(1).
+// Returns false, if there are no games with this configuration.
+bool history_get (uint32_t width, uint32_t height, uint64_t n_mines, struct history_stats *);
+
+#endif // FILE_BSW_HISTORY_H
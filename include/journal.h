@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FILE_BSW_JOURNAL_H
+#define FILE_BSW_JOURNAL_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define JOURNAL_SYNC_MOVES 256              // Moves that are written before syncing early.
+#define JOURNAL_SYNC_MS    500              // Maximum time a move waits to be synced.
+
+struct bsw_board;
+
+// The board of the running game, as stored at the start of `journal.bin`.
+struct journal_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t width, height;
+    uint64_t n_mines;
+    uint32_t seed;
+    int32_t first_x, first_y;
+    uint32_t reserved;
+    int64_t start_time;                     // When the board was generated (seconds since the epoch).
+};
+
+// One click on a tile, the SDL button is stored in the top byte of `y`.
+struct journal_move {
+    uint32_t x, y;
+};
+
+#define journal_move_button(m) ((int)((m)->y >> 24))
+#define journal_move_y(m)      ((int)((m)->y & 0xffffff))
+
+// Load the journal of an unfinished game and start the writer thread.
+bool journal_start (void);
+void journal_quit (void);
+
+// Take the unfinished game found by journal_start(), `*moves` must be freed.
+// Returns false, if there is none.
+bool journal_restore (struct journal_header *, struct journal_move **moves, size_t *n_moves);
+
+// Only called from the game thread. They are no-ops, unless the journal was started.
+void journal_begin (const struct bsw_board *, int first_x, int first_y); // The board was generated.
+void journal_move (int x, int y, int which);
+void journal_clear (void);                  // The game is over or was abandoned.
+
+#endif // FILE_BSW_JOURNAL_H
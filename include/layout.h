@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FILE_BSW_LAYOUT_H
+#define FILE_BSW_LAYOUT_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Mine layouts that are derived from a seed, so any tile can be checked in
+ * O(1) without generating the board.
+ *
+ * The tiles are shuffled by a Feistel network keyed by the seed, and the
+ * first `n_mines` tiles of the shuffle are mines. If the first click hits
+ * one of them, the next tile of the shuffle becomes a mine instead, so the
+ * number of mines is always exact.
+ */
+
+#define LAYOUT_ROUNDS   4
+#define LAYOUT_CODE_MAX 48                  // Longest board code, including the terminator.
+
+struct layout {
+    uint64_t n_tiles, n_mines;
+    uint64_t keys[LAYOUT_ROUNDS];
+    unsigned half_bits;                     // The network permutes numbers of 2 * half_bits bits.
+    uint64_t first;                         // Index of the first click, which is never a mine.
+    bool first_hit;                         // The first click was one of the first `n_mines` tiles.
+};
+
+void layout_init (struct layout *, uint64_t n_tiles, uint64_t n_mines, unsigned seed, uint64_t first);
+bool layout_is_mine (const struct layout *, uint64_t index);
+
+// Position of a tile in the shuffle, and the tile at a position.
+uint64_t layout_rank (const struct layout *, uint64_t index);
+uint64_t layout_tile (const struct layout *, uint64_t rank);
+
+// Index of the `i`-th mine, for i < n_mines.
+uint64_t layout_mine (const struct layout *, uint64_t i);
+
+// A board as "<width>x<height>-<mines>-<seed>", with the seed in hex.
+void layout_code (char buffer[LAYOUT_CODE_MAX], int width, int height, int64_t n_mines, unsigned seed);
+bool layout_parse_code (const char *code, int64_t *width, int64_t *height, int64_t *n_mines, unsigned *seed);
+
+#endif // FILE_BSW_LAYOUT_H
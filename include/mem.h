@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FILE_BSW_MEM_H
+#define FILE_BSW_MEM_H
+#include <stddef.h>
+
+// What the memory is used for.
+enum mem_kind {
+    MEM_BOARD,                              // The tiles and their bit-planes.
+    MEM_VIEWS,                              // Snapshots of the board for the main thread.
+    MEM_BUFFERS,                            // Change lists, the reveal frontier and I/O buffers.
+    MEM_HEATMAP,
+    MEM_TEXTURES,
+    N_MEM_KINDS,
+};
+
+// Record that `bytes` were allocated (or freed, if negative). Thread-safe.
+void mem_account (enum mem_kind, ptrdiff_t bytes);
+size_t mem_used (enum mem_kind);
+size_t mem_total (void);
+
+// Memory that can still be allocated, limited by /proc/meminfo and the
+// cgroup of this process. Returns SIZE_MAX, if it's unknown.
+size_t mem_available (void);
+
+// Memory needed by a board of `width` x `height` tiles, including its views,
+// change lists, frontier or opening index and bit-planes in the worst case.
+size_t mem_board_estimate (int width, int height);
+
+#endif // FILE_BSW_MEM_H
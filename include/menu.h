@@ -18,6 +18,7 @@
 #define FILE_BSW_MENU_H
 #include <SDL2/SDL_rect.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 struct menu;
 
@@ -61,6 +62,7 @@ void menu_init (void);
 void menu_draw (void);
 void menu_update (int ww, int wh);
 bool menu_click (SDL_Point p, int button);
-void menu_draw_int (unsigned value, unsigned len, int x0, int y0, int w, int h);
+// Draw `value` with `len` digits; larger values are shown as all nines.
+void menu_draw_int (uint64_t value, unsigned len, int x0, int y0, int w, int h);
 
 #endif // FILE_BSW_MENU_H
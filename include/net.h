@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FILE_BSW_NET_H
+#define FILE_BSW_NET_H
+#include <stdbool.h>
+#include <stddef.h>
+#include "game.h"
+#include "wire.h"
+
+#define NET_MAX_CLIENTS 16
+#define NET_MAX_OUTPUT  (16 << 20)          // Clients with more unsent are resynced once they catch up.
+
+enum net_mode {
+    NET_NONE,
+    NET_HOST,                               // Resolve all moves and broadcast the changes.
+    NET_CLIENT,                             // Forward all moves to the host.
+};
+
+extern enum net_mode net_mode;
+
+bool net_host (const char *port);
+bool net_connect (const char *address);     // <host>:<port>
+bool net_start (void);
+void net_quit (void);
+
+// Host side, only called from the game thread. `client` is -1 for all clients.
+void net_send_board (int client, int first_x, int first_y);
+void net_send_delta (int client, const size_t *changes, size_t n);
+void net_sync (int client, int first_x, int first_y);
+
+// Client side.
+void net_send_cmd (const struct game_cmd *);
+
+#endif // FILE_BSW_NET_H
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FILE_BSW_POOL_H
+#define FILE_BSW_POOL_H
+#include <stddef.h>
+
+/*
+ * A pool hands out the tiles of many boards from a few large mappings, so
+ * starting and ending lots of games neither maps and unmaps memory for
+ * every board, nor fragments the heap.
+ *
+ * Blocks come in power-of-two size classes. Freed blocks are kept for the
+ * next board of the same class, and freed boards are kept with their
+ * buffers for the next bsw_new_in(). Boards too large for a block get a
+ * mapping of their own.
+ *
+ * A pool and its boards must only be used by one thread at a time.
+ */
+
+#define POOL_MIN_BLOCK (4 << 10)
+#define POOL_MAX_BLOCK (16 << 20)
+#define POOL_CHUNK     (64 << 20)           // Size of the mappings the blocks are taken from.
+
+struct bsw_pool;
+struct bsw_board;
+
+struct bsw_pool *bsw_pool_new (void);
+void bsw_pool_free (struct bsw_pool *);     // Once all boards of the pool were freed.
+
+// Create a board in the pool, bsw_free() gives it back.
+struct bsw_board *bsw_new_in (struct bsw_pool *);
+
+// Take a block of at least `*size` bytes, and round `*size` up to its size.
+// Returns NULL, if `*size` exceeds POOL_MAX_BLOCK or no memory is left.
+void *pool_take (struct bsw_pool *, size_t *size);
+void pool_give (struct bsw_pool *, void *block, size_t size);
+
+// Keep a freed board for the next bsw_new_in(), or take one, if there is any.
+void pool_keep_board (struct bsw_pool *, struct bsw_board *);
+struct bsw_board *pool_take_board (struct bsw_pool *);
+
+#endif // FILE_BSW_POOL_H
@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FILE_BSW_SERVE_H
+#define FILE_BSW_SERVE_H
+#include <stdbool.h>
+
+#define SERVE_MAX_WORKERS 64
+#define SERVE_IDLE_MS     (5 * 60 * 1000)   // Games without a command for this long are evicted.
+#define SERVE_MAX_LINE    (64 << 10)        // Longest command.
+#define SERVE_MAX_OUTPUT  (1 << 20)         // A connection isn't read, while more is unsent.
+#define SERVE_MAX_TILES   (1 << 20)         // Largest board, so no command keeps a worker busy for long.
+
+// Listen on the Unix socket `path`, and serve games in the background.
+bool serve_start (const char *path);
+void serve_stop (void);                     // Close all connections and remove the socket.
+
+// Serve games until SIGINT or SIGTERM, returns the exit code of the process.
+int serve_run (const char *path);
+
+#endif // FILE_BSW_SERVE_H
@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FILE_BSW_SPECTATE_H
+#define FILE_BSW_SPECTATE_H
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SPECTATE_VERSION   3
+#define SPECTATE_RING_SIZE (4 << 20)        // Bytes buffered for a slow consumer.
+
+extern bool spectating;                     // The board follows a stream and ignores input.
+
+// Write the stream to a file, FIFO or Unix socket.
+bool spectate_out (const char *path);
+// Read a stream from a file or FIFO ("-" for stdin) and set up the board for it.
+bool spectate_in (const char *path);
+bool spectate_start (void);
+void spectate_quit (void);
+
+// Only called from the game thread; never blocks.
+void spectate_board (int first_x, int first_y);
+void spectate_delta (const size_t *changes, size_t n);
+
+#endif // FILE_BSW_SPECTATE_H
@@ -18,35 +18,34 @@
 #define FILE_BSW_TILE_H
 #include <SDL2/SDL_events.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "board.h"
 
-enum tile_status {
-    TILE_NONE,                              // The default state of a tile.
-    TILE_MARKED,                            // Clicked w/ right-click.
-    TILE_MARKED2,                           // Clicked w/ right-click twice.
-    TILE_CLICKED,                           // Clicked w/ left-click.
+// Sprites of the composited tile atlas.
+enum tile_sprite {
+    SPRITE_HIDDEN,
+    SPRITE_MARKED,
+    SPRITE_MARKED2,
+    SPRITE_BOMB,                            // A bomb that was clicked.
+    SPRITE_MINE,                            // A bomb revealed after the game is over.
+    SPRITE_0,                               // SPRITE_0 + n: revealed tile with n neighbouring bombs.
+    N_TILE_SPRITES = SPRITE_0 + 9,
 };
 
-struct tile {
-    enum tile_status status;                // Status of this tile.
-    int x, y;                               // Position of this tile.
-    unsigned n_bombs;                       // Number of bombs in the area.
-    bool is_bomb;                           // Is this tile a bomb?
-};
+// Compact encoding of a tile, as seen by the renderer.
+#define TILE_VIEW_BOMB          0x04
+#define tile_view_status(v)     ((enum tile_status)((v) & 0x03))
+#define tile_view_count(v)      ((unsigned)(v) >> 3)
 
-extern struct tile *tiles;
-#define t_width default_width
-#define t_height default_height
-extern int n_bombs, n_selected;
-extern bool generated;
+// Sprite of every tile view, indexed by [show_mines][view].
+extern unsigned char tile_sprite_lut[2][256];
+#define tile_view_sprite(v, show_mines) ((enum tile_sprite)tile_sprite_lut[(show_mines)][(v)])
 
-struct tile *get_tile (int x, int y);
-bool tile_is_bomb (int x, int y);
-void generate_tiles (int x, int y);
-void reset_tiles (void);
-bool init_tiles (void);
-void tile_click (struct tile *, int which);
-void tile_draw (const struct tile *, const SDL_Rect *);
+unsigned char tile_view (const struct tile *);
 
-#define all_selected() (n_selected == (t_width * t_height - n_bombs))
+// Composite every background+glyph combination of `graphics` into one atlas.
+SDL_Surface *tile_compose (SDL_Surface *graphics);
+void tile_draw (unsigned char view, bool show_mines, const SDL_Rect *);
 
 #endif // FILE_BSW_TILE_H
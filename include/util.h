@@ -16,6 +16,7 @@
  */
 #ifndef FILE_BSW_UTIL_H
 #define FILE_BSW_UTIL_H
+#include <stdint.h>
 
 #define arraylen(a) (sizeof (a) / sizeof (*(a)))
 #define my_min(a,b) ((a) < (b) ? (a) : (b))
@@ -37,4 +38,10 @@ void open_url (const char *url);
 // Create directory and parents.
 void mkdir_p (char *);
 
+// Milliseconds on a monotonic clock, unaffected by changes of the system time.
+uint64_t monotonic_ms (void);
+
+// Raise the limit of open files to the hard limit, for many connections.
+void raise_file_limit (void);
+
 #endif // FILE_BSW_UTIL_H
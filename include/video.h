@@ -19,13 +19,23 @@
 #include <SDL2/SDL.h>
 #include <stdbool.h>
 
+// Codes of SDL_USEREVENT.
+enum user_event {
+    EV_LONG_CLICK = 1,                      // A touch was held long enough to mark a tile.
+    EV_REDRAW,                              // The game thread published a new board.
+    EV_GAME_LOST,                           // A bomb was hit.
+    EV_TICK,                                // The game timer advanced by a second.
+};
+
 extern float t_offX, t_offY, t_size;
 extern int w_width, w_height;
+extern Uint64 last_render;                  // SDL_GetPerformanceCounter() after the last full frame was presented.
 extern bool shift_pressed;
 
 extern SDL_Window *window;
 extern SDL_Renderer *renderer;
 extern SDL_Texture *sprite;
+extern SDL_Texture *tile_sprite;
 extern SDL_Haptic *haptic;
 
 bool video_init (void);
@@ -33,6 +43,11 @@ void video_quit (void);
 void video_post_init (void);
 
 void render (void);
+// Update only the HUD, e.g. the timer.
+void render_tick (void);
 bool handle_event (const SDL_Event *);
+// Draw the next frame of panning or zooming when it is due. Returns the
+// milliseconds until the frame after it, or -1 if nothing is moving.
+int animate (void);
 
 #endif // FILE_BSW_VIDEO_H
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FILE_BSW_WIRE_H
+#define FILE_BSW_WIRE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Binary encoding of boards and board changes, shared by co-op and the
+ * spectator stream.
+ *
+ * Every message starts with a type (u8) and the length of its payload (u32),
+ * all integers are big-endian:
+ *
+ *   MSG_BOARD: width u32, height u32, mines u64, seed u32, generated u8,
+ *              first_x i32, first_y i32
+ *   MSG_DELTA: game_over u8, followed by the changed tiles in ascending
+ *              order, each as a varint of (index - previous_index) << 2 | status
+ *   MSG_CMD:   type u8, x i32, y i32, arg i32 (co-op client to host)
+ */
+
+#define MSG_HEADER_SIZE 5
+#define MSG_MAX_SIZE    (256 << 20)
+
+enum msg_type {
+    MSG_BOARD = 1,
+    MSG_DELTA,
+    MSG_CMD,
+};
+
+struct bsw_board;
+
+struct buffer {
+    unsigned char *data;
+    size_t len, cap;
+};
+
+// Parameters of a board; the seed and first click reproduce its mines.
+struct net_board {
+    int width, height;
+    int64_t n_mines;
+    unsigned seed;
+    bool generated;
+    int first_x, first_y;
+};
+
+struct net_delta {
+    bool game_over;
+    size_t n;
+    struct {
+        size_t index;
+        unsigned char status;
+    } tiles[];
+};
+
+void buf_reserve (struct buffer *, size_t n);
+void buf_put (struct buffer *, const void *data, size_t n);
+void buf_put_u8 (struct buffer *, uint8_t);
+void buf_put_u32 (struct buffer *, uint32_t);
+void buf_put_u64 (struct buffer *, uint64_t);
+void buf_put_varint (struct buffer *, uint64_t);
+void buf_consume (struct buffer *, size_t n);
+void buf_free (struct buffer *);
+uint32_t get_u32 (const unsigned char *);
+uint64_t get_u64 (const unsigned char *);
+
+// Start a message, returns the position of its header.
+size_t msg_begin (struct buffer *, enum msg_type);
+void msg_end (struct buffer *, size_t pos);
+
+// Get the next complete message from `b`, returns its size or 0.
+size_t msg_next (const struct buffer *b, enum msg_type *, const unsigned char **payload, size_t *len, bool *error);
+
+// Encode a board, or changes to it.
+void wire_put_board (struct buffer *, const struct bsw_board *, int first_x, int first_y);
+void wire_put_delta (struct buffer *, const struct bsw_board *, const size_t *changes, size_t n);
+
+// Indices of all tiles that differ from a fresh board.
+size_t wire_board_changes (const struct bsw_board *, size_t **changes);
+
+struct net_board *wire_get_board (const unsigned char *payload, size_t len);
+struct net_delta *wire_get_delta (const unsigned char *payload, size_t len);
+
+#endif // FILE_BSW_WIRE_H
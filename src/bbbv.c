@@ -0,0 +1,433 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "bitboard.h"
+#include "bbbv.h"
+#include "board.h"
+#include "util.h"
+#include "mem.h"
+
+#define MINE 0xff                           // Count of a tile that is a bomb.
+
+// A run of zeros in a row, from `start` to `end` (exclusive).
+// All rows have a tile of padding on both sides, which is never zero.
+struct bbbv_run {
+    int start, end;
+    uint32_t label;                         // Opening of the run.
+};
+
+
+// Copy the bombs of row `y`, so every tile is only read once.
+static void
+read_bombs (const struct bbbv *s, unsigned char *bombs, int y)
+{
+    const int w = s->width;
+    const struct tile *row = s->tiles + (size_t)y * w;
+
+    for (int x = 0; x < w; ++x)
+        bombs[x + 1] = row[x].is_bomb;
+}
+
+static uint32_t
+find (struct bbbv *s, uint32_t l)
+{
+    while (s->parent[l] != l) {
+        s->parent[l] = s->parent[s->parent[l]];
+        l = s->parent[l];
+    }
+    return l;
+}
+
+static uint32_t
+find_root (struct bbbv *s, uint32_t r)
+{
+    while (s->roots[r] != r) {
+        s->roots[r] = s->roots[s->roots[r]];
+        r = s->roots[r];
+    }
+    return r;
+}
+
+// Add an opening to the index, returns its number.
+static uint32_t
+new_root (struct bbbv *s)
+{
+    if (s->n_roots == s->cap_roots) {
+        const size_t cap = s->cap_roots ? s->cap_roots * 2 : 256;
+        uint32_t *new_roots = realloc (s->roots, cap * sizeof (uint32_t));
+        if (!new_roots) {
+            perror ("realloc()");
+            abort ();
+        }
+        mem_account (MEM_BUFFERS, (cap - s->cap_roots) * sizeof (uint32_t));
+        s->roots = new_roots;
+        s->cap_roots = cap;
+    }
+    s->roots[s->n_roots] = s->n_roots;
+    return s->n_roots++;
+}
+
+// Merge the opening of `l` with the one of `other`, returns the root of both.
+static uint32_t
+merge (struct bbbv *s, uint32_t l, uint32_t other)
+{
+    other = find (s, other);
+    if (other != l) {
+        s->parent[other] = l;
+        --s->n_openings;
+        if (s->index)
+            s->roots[find_root (s, s->opening[other])] = find_root (s, s->opening[l]);
+    }
+    return l;
+}
+
+static void
+add_span (struct bbbv *s, int start, int end, uint32_t root)
+{
+    struct bbbv_openings *o = s->index;
+
+    if (o->n_spans == o->cap_spans) {
+        const size_t cap = o->cap_spans ? o->cap_spans * 2 : 256;
+        struct bbbv_span *new_spans = realloc (o->spans, cap * sizeof (struct bbbv_span));
+        uint32_t *new_labels = new_spans ? realloc (o->labels, cap * sizeof (uint32_t)) : NULL;
+        if (!new_labels) {
+            perror ("realloc()");
+            abort ();
+        }
+        mem_account (MEM_BUFFERS, (cap - o->cap_spans) * (sizeof (struct bbbv_span) + sizeof (uint32_t)));
+        o->size += (cap - o->cap_spans) * (sizeof (struct bbbv_span) + sizeof (uint32_t));
+        o->spans = new_spans;
+        o->labels = new_labels;
+        o->cap_spans = cap;
+    }
+    o->spans[o->n_spans] = (struct bbbv_span){ s->y, start, end };
+    o->labels[o->n_spans++] = root;
+}
+
+void
+bbbv_openings_free (struct bbbv_openings *o)
+{
+    free (o->spans);
+    free (o->labels);
+    free (o->rows);
+    free (o->members);
+    free (o->first);
+    free (o->swept);
+    mem_account (MEM_BUFFERS, -(ptrdiff_t)o->size);
+    memset (o, 0, sizeof *o);
+}
+
+void
+bbbv_free (struct bbbv *s)
+{
+    free (s->counts);
+    free (s->run_rows);
+    free (s->parent);
+    free (s->opening);
+    free (s->roots);
+    mem_account (MEM_BUFFERS, -(ptrdiff_t)(s->size + s->cap_roots * sizeof (uint32_t)));
+    s->counts = NULL;
+    s->run_rows = NULL;
+    s->parent = NULL;
+    s->opening = NULL;
+    s->roots = NULL;
+    s->index = NULL;
+    s->planes = NULL;
+    s->size = 0;
+    s->cap_roots = 0;
+}
+
+void
+bbbv_begin (struct bbbv *s, const struct tile *tiles, int width, int height,
+            struct bbbv_openings *index, struct bitboard *planes)
+{
+    const size_t w = width + 2, max_runs = w / 2;
+
+    bbbv_free (s);
+    memset (s, 0, sizeof *s);
+    s->tiles = tiles;
+    s->width = width;
+    s->height = height;
+    s->planes = planes;
+
+    s->counts = malloc (8 * w);
+    s->run_rows = malloc (2 * max_runs * sizeof (struct bbbv_run));
+    s->parent = malloc (2 * (w + 1) * sizeof (uint32_t));
+    if (!s->counts || !s->run_rows || !s->parent) {
+        perror ("malloc()");
+        abort ();
+    }
+    s->rows[0] = s->counts;
+    s->rows[1] = s->rows[0] + w;
+    s->rows[2] = s->rows[1] + w;
+    s->bombs[0] = s->rows[2] + w;
+    s->bombs[1] = s->bombs[0] + w;
+    s->bombs[2] = s->bombs[1] + w;
+    s->column = s->bombs[2] + w;
+    s->near_zero = s->column + w;
+    s->runs[0] = s->run_rows;
+    s->runs[1] = s->runs[0] + max_runs;
+    s->remap = s->parent + w + 1;
+    s->size = 8 * w + 2 * max_runs * sizeof (struct bbbv_run) + 2 * (w + 1) * sizeof (uint32_t);
+    mem_account (MEM_BUFFERS, s->size);
+
+    // The rows above the board have no zeros.
+    memset (s->rows[0], MINE, 3 * w);
+    memset (s->bombs[0], 0, 5 * w);
+    memset (s->remap, 0, (w + 1) * sizeof (uint32_t));
+    read_bombs (s, s->bombs[2], 0);
+
+    // The spans are numbered with 32 bits; every span takes at least 4 tiles.
+    if (index)
+        bbbv_openings_free (index);
+    if (index && (uint64_t)width * height / 4 < UINT32_MAX) {
+        s->index = index;
+        s->opening = malloc (2 * (w + 1) * sizeof (uint32_t));
+        index->rows = malloc ((height + 1) * sizeof (size_t));
+        if (!s->opening || !index->rows) {
+            perror ("malloc()");
+            abort ();
+        }
+        s->next_opening = s->opening + w + 1;
+        s->size += 2 * (w + 1) * sizeof (uint32_t);
+        index->size = (height + 1) * sizeof (size_t);
+        mem_account (MEM_BUFFERS, 2 * (w + 1) * sizeof (uint32_t) + index->size);
+    }
+}
+
+// Count the bombs around the tiles of row `y`.
+static void
+count_row (struct bbbv *s, unsigned char *row, int y)
+{
+    const int w = s->width;
+    unsigned char *const top = s->bombs[0], *col = s->column;
+    const unsigned char *above, *middle, *below;
+
+    // The bombs move up by one; the row below the board has none.
+    s->bombs[0] = s->bombs[1];
+    s->bombs[1] = s->bombs[2];
+    s->bombs[2] = top;
+    if (y + 1 < s->height) {
+        read_bombs (s, top, y + 1);
+    } else {
+        memset (top, 0, w + 2);
+    }
+
+    above = s->bombs[0];
+    middle = s->bombs[1];
+    below = s->bombs[2];
+    // Without branches, so the compiler can vectorize both loops; bombs become MINE.
+    for (int x = 1; x <= w; ++x)
+        col[x] = above[x] + middle[x] + below[x];
+    for (int x = 1; x <= w; ++x)
+        row[x] = (col[x - 1] + col[x] + col[x + 1]) | (unsigned char)-middle[x];
+
+    if (s->planes) {
+        bitboard_pack (bitboard_row (s->planes, s->planes->mines, y), middle + 1, w, 1);
+        bitboard_pack (bitboard_row (s->planes, s->planes->zeros, y), row + 1, w, 0);
+    }
+}
+
+// Find the runs of zeros in `row`, and merge them with the ones above that
+// touch them. The zeros are connected diagonally as well.
+static void
+label_row (struct bbbv *s, const unsigned char *row)
+{
+    const int w = s->width;
+    const struct bbbv_run *above = s->runs[0];
+    const size_t n_above = s->n_runs[0];
+    struct bbbv_run *runs = s->runs[1];
+    size_t n = 0, j = 0;
+
+    if (s->index)
+        s->index->rows[s->y] = s->index->n_spans;
+
+    for (int x = 1; x <= w; ++x) {
+        if (row[x] != 0)
+            continue;
+
+        // The padding ends every run.
+        struct bbbv_run *r = &runs[n++];
+        uint32_t l = 0;
+        r->start = x;
+        while (row[x] == 0)
+            ++x;
+        r->end = x;
+
+        while (j < n_above && above[j].end < r->start)
+            ++j;
+        for (size_t k = j; k < n_above && above[k].start <= r->end; ++k)
+            l = l ? merge (s, l, above[k].label) : find (s, above[k].label);
+
+        if (l == 0) {
+            l = ++s->n_labels;
+            s->parent[l] = l;
+            ++s->n_openings;
+            if (s->index)
+                s->opening[l] = new_root (s);
+        }
+        r->label = l;
+        if (s->index)
+            add_span (s, r->start - 1, r->end - 1, s->opening[l]);
+    }
+
+    // Number the openings of this row from 1 again, so the labels never
+    // exceed the width of the board.
+    uint32_t n_labels = 0;
+    for (size_t i = 0; i < n; ++i) {
+        const uint32_t root = find (s, runs[i].label);
+        if (s->remap[root] == 0) {
+            s->remap[root] = ++n_labels;
+            if (s->index)
+                s->next_opening[n_labels] = s->opening[root];
+        }
+        runs[i].label = s->remap[root];
+    }
+    memset (s->remap, 0, (s->n_labels + 1) * sizeof (uint32_t));
+    for (uint32_t i = 1; i <= n_labels; ++i)
+        s->parent[i] = i;
+    s->n_labels = n_labels;
+    if (s->index)
+        memcpy (s->opening + 1, s->next_opening + 1, n_labels * sizeof (uint32_t));
+
+    s->runs[1] = s->runs[0];
+    s->runs[0] = runs;
+    s->n_runs[0] = n;
+}
+
+// Count the numbers of the middle row, that don't border a zero.
+static void
+count_isolated (struct bbbv *s, const unsigned char *above, const unsigned char *row, const unsigned char *below)
+{
+    const int w = s->width;
+    unsigned char *z = s->near_zero;
+    size_t n = 0;
+
+    for (int x = 1; x <= w; ++x)
+        z[x] = (above[x] == 0) | (row[x] == 0) | (below[x] == 0);
+    for (int x = 1; x <= w; ++x)
+        n += ((unsigned char)(row[x] - 1) < 8) & !(z[x - 1] | z[x] | z[x + 1]);
+    s->n_isolated += n;
+}
+
+// Group the spans by their opening, once all merges are known.
+static void
+finish_index (struct bbbv *s)
+{
+    struct bbbv_openings *o = s->index;
+    uint32_t *number = malloc (s->n_roots * sizeof (uint32_t) + 1);
+    size_t n = 0;
+
+    o->members = malloc (o->n_spans * sizeof (uint32_t) + 1);
+    o->first = calloc (s->n_openings + 1, sizeof (size_t));
+    o->swept = calloc (s->n_openings + 1, sizeof (bool));
+    if (!number || !o->members || !o->first || !o->swept) {
+        perror ("malloc()");
+        abort ();
+    }
+    o->rows[s->height] = o->n_spans;
+    o->n_openings = s->n_openings;
+    o->size += o->n_spans * sizeof (uint32_t) + (s->n_openings + 1) * (sizeof (size_t) + sizeof (bool));
+    mem_account (MEM_BUFFERS, o->n_spans * sizeof (uint32_t) + (s->n_openings + 1) * (sizeof (size_t) + sizeof (bool)));
+
+    // Number the openings from 0, and count their spans.
+    for (size_t r = 0; r < s->n_roots; ++r) {
+        if (s->roots[r] == r)
+            number[r] = n++;
+    }
+    for (size_t i = 0; i < o->n_spans; ++i) {
+        o->labels[i] = number[find_root (s, o->labels[i])];
+        ++o->first[o->labels[i] + 1];
+    }
+    for (size_t k = 0; k < o->n_openings; ++k)
+        o->first[k + 1] += o->first[k];
+
+    // The spans of every opening stay in the order of the rows.
+    for (size_t k = 0; k < o->n_openings; ++k)
+        number[k] = o->first[k];
+    for (size_t i = 0; i < o->n_spans; ++i)
+        o->members[number[o->labels[i]]++] = i;
+    free (number);
+}
+
+size_t
+bbbv_opening_at (const struct bbbv_openings *o, int x, int y)
+{
+    size_t lo, hi;
+
+    if (!o->first)
+        return SIZE_MAX;
+
+    lo = o->rows[y];
+    hi = o->rows[y + 1];
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (o->spans[mid].end <= (uint32_t)x) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < o->rows[y + 1] && o->spans[lo].start <= (uint32_t)x ? o->labels[lo] : SIZE_MAX;
+}
+
+bool
+bbbv_work (struct bbbv *s, size_t *budget)
+{
+    while (s->y <= s->height && *budget != 0) {
+        unsigned char *const top = s->rows[0];
+
+        // The rows move up by one; the row below the board has no zeros.
+        s->rows[0] = s->rows[1];
+        s->rows[1] = s->rows[2];
+        s->rows[2] = top;
+        if (s->y < s->height) {
+            count_row (s, s->rows[2], s->y);
+            label_row (s, s->rows[2]);
+        } else {
+            memset (s->rows[2], MINE, s->width + 2);
+        }
+        if (s->y > 0)
+            count_isolated (s, s->rows[0], s->rows[1], s->rows[2]);
+
+        *budget -= my_min (*budget, (size_t)s->width);
+        ++s->y;
+    }
+
+    if (s->y <= s->height)
+        return false;
+
+    if (s->index)
+        finish_index (s);
+    bbbv_free (s);
+    return true;
+}
+
+float
+bbbv_progress (const struct bbbv *s)
+{
+    return s->height ? (float)s->y / (s->height + 1) : 1.0f;
+}
+
+size_t
+bbbv_result (const struct bbbv *s)
+{
+    return s->n_openings + s->n_isolated;
+}
@@ -0,0 +1,583 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmarks that run without a window.
+ *
+ *   counts   Time from the first click to the revealed opening, counting the
+ *            neighbouring bombs of every tile right after generating the board
+ *            (eager), or only those of the revealed tiles (lazy).
+ *   bbbv     Time spent generating a board, and the part of it spent on
+ *            counting its 3BV, indexing its openings and filling its
+ *            bit-planes.
+ *   serve    Load generator for the board server: LOAD_CONNS bots play
+ *            beginner games with random reveals for LOAD_SECONDS, one
+ *            command at a time each. Loads the server of '--serve <path>',
+ *            or a server of its own.
+ *   latency  Time from a synthetic click, pan or zoom to the next frame on
+ *            screen, through the real event handling and rendering with
+ *            SDL's dummy video driver. LATENCY_EVENTS events of each kind
+ *            are pushed at LATENCY_HZ on every board.
+ */
+#include <SDL2/SDL_thread.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include "heatmap.h"
+#include "dialog.h"
+#include "bench.h"
+#include "serve.h"
+#include "board.h"
+#include "video.h"
+#include "game.h"
+#include "menu.h"
+#include "bbbv.h"
+#include "util.h"
+#include "wire.h"
+#include "mem.h"
+#include "bsw.h"
+
+#define LOAD_CONNS    2000
+#define LOAD_THREADS  4
+#define LOAD_SECONDS  5
+#define LOAD_MAX_US   (1 << 16)             // Longer latencies are counted together.
+
+#define LATENCY_EVENTS     60
+#define LATENCY_HZ         30
+#define LATENCY_TIMEOUT_MS 2000             // Events without a frame after this count as lost.
+#define LATENCY_QUIET_MS   100              // Time without frames before the next kind of event.
+
+struct bench_board {
+    int width, height;
+    size_t n_mines;
+    int runs;
+};
+
+static double
+now_ms (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Generate a board and reveal its center, returns the time it took.
+static double
+first_click (unsigned seed, bool eager)
+{
+    const int cx = board->width / 2, cy = board->height / 2;
+    double start;
+
+    bsw_reset (board);
+    bsw_work (board, (size_t)-1);
+    board->seed = seed;
+
+    start = now_ms ();
+    bsw_generate (board, cx, cy);
+    bsw_work (board, (size_t)-1);
+    if (eager) {
+        for (int y = 0; y < board->height; ++y) {
+            for (int x = 0; x < board->width; ++x)
+                bsw_tile (board, x, y)->n_bombs = bsw_count_bombs (board, x, y);
+        }
+    }
+    bsw_click (board, bsw_tile (board, cx, cy));
+    bsw_reveal (board, (size_t)-1);
+    bsw_clear_changes (board);
+    return now_ms () - start;
+}
+
+static int
+bench_counts (void)
+{
+    const struct bench_board boards[] = {
+        { default_presets[0][0], default_presets[0][1], default_presets[0][2], 1000 },
+        { default_presets[1][0], default_presets[1][1], default_presets[1][2], 1000 },
+        { default_presets[2][0], default_presets[2][1], default_presets[2][2], 1000 },
+        { 1000, 1000, 150000, 10 },
+        { 4000, 4000, 2400000, 3 },
+    };
+
+    printf ("%-16s %12s %12s %8s\n", "board", "eager (ms)", "lazy (ms)", "speedup");
+    for (size_t i = 0; i < sizeof boards / sizeof *boards; ++i) {
+        const struct bench_board *b = &boards[i];
+        double eager = 0.0, lazy = 0.0;
+        char name[32];
+
+        if (!bsw_resize (board, b->width, b->height, b->n_mines))
+            continue;
+
+        // Alternate between both, so neither gets the warmer caches.
+        for (int run = 0; run < b->runs; ++run) {
+            eager += first_click (run, true);
+            lazy += first_click (run, false);
+        }
+        eager /= b->runs;
+        lazy /= b->runs;
+
+        snprintf (name, sizeof name, "%dx%d/%zu", b->width, b->height, b->n_mines);
+        printf ("%-16s %12.3f %12.3f %7.1fx\n", name, eager, lazy, eager / lazy);
+    }
+
+    bsw_free (board);
+    board = NULL;
+    return 0;
+}
+
+static int
+bench_bbbv (void)
+{
+    const struct bench_board boards[] = {
+        { default_presets[2][0], default_presets[2][1], default_presets[2][2], 1000 },
+        { 1000, 1000, 160000, 10 },
+        { 4000, 4000, 2560000, 3 },
+        { 10000, 10000, 16000000, 1 },
+    };
+
+    printf ("%-20s %14s %10s %8s %10s\n", "board", "generate (ms)", "3bv (ms)", "share", "3bv");
+    for (size_t i = 0; i < sizeof boards / sizeof *boards; ++i) {
+        const struct bench_board *b = &boards[i];
+        double generate = 0.0, rate = 0.0, start;
+        char name[32];
+
+        if (!bsw_check_memory (board, b->width, b->height) || !bsw_resize (board, b->width, b->height, b->n_mines))
+            continue;
+
+        for (int run = 0; run < b->runs; ++run) {
+            struct bbbv_openings openings = { 0 };
+            struct bitboard planes = { 0 };
+            struct bbbv rating = { 0 };
+            size_t budget = (size_t)-1;
+
+            bsw_reset (board);
+            bsw_work (board, (size_t)-1);
+            board->seed = run;
+
+            // Includes the 3BV, which is counted again on its own.
+            start = now_ms ();
+            bsw_generate (board, b->width / 2, b->height / 2);
+            bsw_work (board, (size_t)-1);
+            generate += now_ms () - start;
+
+            bitboard_resize (&planes, board->width, board->height);
+            start = now_ms ();
+            bbbv_begin (&rating, board->tiles, board->width, board->height, &openings, &planes);
+            bbbv_work (&rating, &budget);
+            rate += now_ms () - start;
+            bbbv_free (&rating);
+            bbbv_openings_free (&openings);
+            bitboard_free (&planes);
+        }
+        generate /= b->runs;
+        rate /= b->runs;
+
+        snprintf (name, sizeof name, "%dx%d/%zu", b->width, b->height, b->n_mines);
+        printf ("%-20s %14.3f %10.3f %7.1f%% %10zu\n", name, generate, rate, rate / generate * 100.0, board->bbbv);
+    }
+
+    bsw_free (board);
+    board = NULL;
+    return 0;
+}
+
+struct load_conn {
+    int fd;
+    unsigned rand_state;
+    struct buffer in;
+    double sent;                            // now_ms() of the command waiting for its answer.
+};
+
+struct load_thread {
+    SDL_Thread *thread;
+    const char *path;
+    double end;                             // now_ms() when to stop.
+    struct load_conn conns[LOAD_CONNS / LOAD_THREADS];
+    size_t n_conns, n_commands, n_games, n_errors;
+    size_t latency[LOAD_MAX_US + 1];        // Number of answers by microseconds.
+};
+
+static int
+load_connect (const char *path)
+{
+    struct sockaddr_un addr;
+    const int fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    memset (&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    snprintf (addr.sun_path, sizeof addr.sun_path, "%s", path);
+    if (fd >= 0 && connect (fd, (struct sockaddr *)&addr, sizeof addr) != 0) {
+        close (fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Send the next command of a bot: a new game after `answer` ended one, or a random reveal.
+static bool
+load_send (struct load_conn *c, char answer)
+{
+    char cmd[64];
+    int len;
+
+    if (answer == 'p') {
+        len = snprintf (cmd, sizeof cmd, "r %d %d\n", rand_r (&c->rand_state) % default_presets[0][0],
+                        rand_r (&c->rand_state) % default_presets[0][1]);
+    } else {
+        len = snprintf (cmd, sizeof cmd, "n %d %d %d %d\n", default_presets[0][0], default_presets[0][1],
+                        default_presets[0][2], rand_r (&c->rand_state));
+    }
+    c->sent = now_ms ();
+    return send (c->fd, cmd, len, MSG_NOSIGNAL) == len;
+}
+
+// Handle the answers of a bot; returns false, if the connection was closed.
+static bool
+load_receive (struct load_thread *t, struct load_conn *c)
+{
+    unsigned char *line, *end;
+    ssize_t n;
+
+    buf_reserve (&c->in, 4096);
+    n = recv (c->fd, c->in.data + c->in.len, c->in.cap - c->in.len, 0);
+    if (n <= 0)
+        return n < 0 && (errno == EAGAIN || errno == EINTR);
+    c->in.len += n;
+
+    for (line = c->in.data; (end = memchr (line, '\n', c->in.data + c->in.len - line)); line = end + 1) {
+        const size_t us = (now_ms () - c->sent) * 1000.0;
+
+        ++t->latency[my_min (us, LOAD_MAX_US)];
+        ++t->n_commands;
+        t->n_games += *line == 'w' || *line == 'l';
+        t->n_errors += *line == 'e';
+        if (now_ms () < t->end && !load_send (c, *line))
+            return false;
+    }
+    buf_consume (&c->in, line - c->in.data);
+    return true;
+}
+
+static int
+load_thread (void *arg)
+{
+    struct load_thread *t = arg;
+    struct epoll_event events[64];
+    size_t n_open = 0;
+    int epoll_fd;
+
+    epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        perror ("epoll_create1()");
+        return 1;
+    }
+
+    for (size_t i = 0; i < t->n_conns; ++i) {
+        struct load_conn *c = &t->conns[i];
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+
+        c->fd = load_connect (t->path);
+        c->rand_state = i;
+        if (c->fd < 0 || epoll_ctl (epoll_fd, EPOLL_CTL_ADD, c->fd, &ev) != 0 || !load_send (c, 'n')) {
+            fprintf (stderr, "Failed to connect to '%s': %s\n", t->path, strerror (errno));
+            ++t->n_errors;
+            continue;
+        }
+        ++n_open;
+    }
+
+    // Every bot has one command in flight, until the time is up.
+    while (n_open != 0) {
+        const int n = epoll_wait (epoll_fd, events, 64, 1000);
+
+        for (int i = 0; i < n; ++i) {
+            struct load_conn *c = events[i].data.ptr;
+            if (!load_receive (t, c) || (now_ms () >= t->end && c->in.len == 0)) {
+                close (c->fd);
+                c->fd = -1;
+                --n_open;
+            }
+        }
+        if (n <= 0 && now_ms () >= t->end + 1000.0)
+            break;
+    }
+
+    for (size_t i = 0; i < t->n_conns; ++i) {
+        if (t->conns[i].fd >= 0)
+            close (t->conns[i].fd);
+        buf_free (&t->conns[i].in);
+    }
+    close (epoll_fd);
+    return 0;
+}
+
+// Microseconds within which `q` of all answers arrived.
+static size_t
+load_percentile (const size_t *latency, size_t total, double q)
+{
+    size_t sum = 0;
+
+    for (size_t us = 0; us < LOAD_MAX_US; ++us) {
+        sum += latency[us];
+        if (sum > q * total)
+            return us;
+    }
+    return LOAD_MAX_US;
+}
+
+static int
+bench_serve (const char *path)
+{
+    static struct load_thread threads[LOAD_THREADS];
+    static size_t latency[LOAD_MAX_US + 1];
+    size_t n_commands = 0, n_games = 0, n_errors = 0;
+    char own_path[64];
+    double start;
+
+    raise_file_limit ();
+    if (!path) {
+        snprintf (own_path, sizeof own_path, "/tmp/billig-sweeper-bench-%d.sock", (int)getpid ());
+        path = own_path;
+        if (!serve_start (path))
+            return 1;
+    }
+
+    start = now_ms ();
+    for (int i = 0; i < LOAD_THREADS; ++i) {
+        struct load_thread *t = &threads[i];
+        t->path = path;
+        t->end = start + LOAD_SECONDS * 1000.0;
+        t->n_conns = LOAD_CONNS / LOAD_THREADS;
+        t->thread = SDL_CreateThread (&load_thread, "load", t);
+    }
+    for (int i = 0; i < LOAD_THREADS; ++i) {
+        struct load_thread *t = &threads[i];
+        if (t->thread)
+            SDL_WaitThread (t->thread, NULL);
+        n_commands += t->n_commands;
+        n_games += t->n_games;
+        n_errors += t->n_errors;
+        for (size_t us = 0; us <= LOAD_MAX_US; ++us)
+            latency[us] += t->latency[us];
+    }
+    const double seconds = (now_ms () - start) / 1000.0;
+
+    printf ("%-12s %12s %10s %10s %10s %10s %8s\n", "connections", "commands/s", "games/s",
+            "p50 (us)", "p99 (us)", "p99.9 (us)", "errors");
+    printf ("%-12d %12.0f %10.0f %10zu %10zu %10zu %8zu\n", LOAD_CONNS, n_commands / seconds, n_games / seconds,
+            load_percentile (latency, n_commands, 0.5), load_percentile (latency, n_commands, 0.99),
+            load_percentile (latency, n_commands, 0.999), n_errors);
+
+    if (path == own_path) {
+        printf ("Server memory: board %zu KiB, buffers %zu KiB\n", mem_used (MEM_BOARD) >> 10, mem_used (MEM_BUFFERS) >> 10);
+        serve_stop ();
+    }
+    return n_errors != 0;
+}
+
+enum latency_kind {
+    LATENCY_CLICK,
+    LATENCY_PAN,
+    LATENCY_ZOOM,
+    N_LATENCY_KINDS,
+};
+
+static const char *const latency_names[N_LATENCY_KINDS] = { "click", "pan", "zoom" };
+static int anim_timeout = -1;
+
+// One iteration of the main loop, waiting at most `max_ms` for an event.
+static void
+pump (int max_ms)
+{
+    SDL_Event e;
+
+    if (SDL_WaitEventTimeout (&e, anim_timeout < 0 ? max_ms : my_min (anim_timeout, max_ms)))
+        handle_event (&e);
+    anim_timeout = animate ();
+}
+
+// Keep the main loop running until no frames were drawn for a while.
+static void
+settle (void)
+{
+    const Uint64 quiet = SDL_GetPerformanceFrequency () * LATENCY_QUIET_MS / 1000;
+
+    while (anim_timeout >= 0 || SDL_GetPerformanceCounter () - last_render < quiet)
+        pump (10);
+}
+
+// A left click on a random tile on screen, a pan back or forth, or a
+// notch of the mouse wheel in or out.
+static void
+latency_event (SDL_Event *e, enum latency_kind kind, int i)
+{
+    const struct board_view *v = game_view ();
+    const int ts = t_size;
+    const int x0 = my_max ((int)(t_offX * ts), 0), x1 = my_min ((int)(t_offX * ts) + v->width * ts, w_width);
+    const int y0 = my_max ((int)(t_offY * ts), 0), y1 = my_min ((int)(t_offY * ts) + v->height * ts, w_height);
+    const int dir = i % 2 ? -1 : 1;
+
+    SDL_zerop (e);
+    switch (kind) {
+    case LATENCY_CLICK:
+        e->button.type = SDL_MOUSEBUTTONUP;
+        e->button.button = SDL_BUTTON_LEFT;
+        e->button.state = SDL_RELEASED;
+        e->button.clicks = 1;
+        e->button.x = x1 > x0 ? rrand (x0, x1 - 1) : w_width / 2;
+        e->button.y = y1 > y0 ? rrand (y0, y1 - 1) : w_height / 2;
+        break;
+    case LATENCY_PAN:
+        e->motion.type = SDL_MOUSEMOTION;
+        e->motion.state = SDL_BUTTON_MMASK;
+        e->motion.x = w_width / 2;
+        e->motion.y = w_height / 2;
+        e->motion.xrel = dir * 20;
+        e->motion.yrel = dir * 10;
+        break;
+    case LATENCY_ZOOM:
+        e->wheel.type = SDL_MOUSEWHEEL;
+        e->wheel.y = dir;
+        e->wheel.preciseY = dir;
+        break;
+    default:
+        break;
+    }
+}
+
+static int
+cmp_double (const void *a, const void *b)
+{
+    const double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Push the events of one kind at LATENCY_HZ, and record the time until
+// the next full frame in `latency`, returns the number of lost events.
+static int
+latency_run (enum latency_kind kind, double *latency)
+{
+    const Uint64 freq = SDL_GetPerformanceFrequency ();
+    const Uint64 period = freq / LATENCY_HZ, timeout = freq * LATENCY_TIMEOUT_MS / 1000;
+    Uint64 next = SDL_GetPerformanceCounter ();
+    int lost = 0;
+
+    for (int i = 0; i < LATENCY_EVENTS; ++i) {
+        SDL_Event e;
+        Uint64 start;
+
+        while (SDL_GetPerformanceCounter () < next)
+            pump ((next - SDL_GetPerformanceCounter ()) * 1000 / freq);
+        next += period;
+
+        latency_event (&e, kind, i);
+        start = SDL_GetPerformanceCounter ();
+        SDL_PushEvent (&e);
+        while (last_render < start && SDL_GetPerformanceCounter () - start < timeout)
+            pump (1);
+
+        if (last_render < start) {
+            latency[i] = LATENCY_TIMEOUT_MS;
+            ++lost;
+        } else {
+            latency[i] = (last_render - start) * 1000.0 / freq;
+        }
+    }
+
+    qsort (latency, LATENCY_EVENTS, sizeof *latency, &cmp_double);
+    return lost;
+}
+
+static int
+bench_latency (void)
+{
+    const struct bench_board boards[] = {
+        { default_presets[0][0], default_presets[0][1], default_presets[0][2], 0 },
+        { default_presets[1][0], default_presets[1][1], default_presets[1][2], 0 },
+        { default_presets[2][0], default_presets[2][1], default_presets[2][2], 0 },
+        { 200, 150, 4500, 0 },
+        { 800, 600, 72000, 0 },
+    };
+    double latency[LATENCY_EVENTS];
+
+    // Draw offscreen, without vsync.
+    SDL_SetHintWithPriority (SDL_HINT_VIDEODRIVER, "dummy", SDL_HINT_OVERRIDE);
+    if (!video_init ())
+        return 1;
+    if (!heatmap_init () || !game_init ()) {
+        game_quit ();
+        heatmap_quit ();
+        video_quit ();
+        return 1;
+    }
+    menu_init ();
+    dialog_init ();
+    menu.shown = false;
+
+    printf ("%-16s %-6s %10s %10s %10s %10s %6s\n", "board", "event", "p50 (ms)", "p90 (ms)", "p99 (ms)", "max (ms)", "lost");
+    for (size_t i = 0; i < sizeof boards / sizeof *boards; ++i) {
+        const struct bench_board *b = &boards[i];
+        const struct board_view *v;
+        char name[32];
+
+        // Wait for the new board, and fit it into the window.
+        game_resize (b->width, b->height, b->n_mines);
+        do {
+            pump (10);
+            v = game_view ();
+        } while (v->width != b->width || v->height != b->height);
+        video_post_init ();
+        render ();
+        settle ();
+
+        snprintf (name, sizeof name, "%dx%d/%zu", b->width, b->height, b->n_mines);
+        for (int kind = 0; kind < N_LATENCY_KINDS; ++kind) {
+            const int lost = latency_run (kind, latency);
+
+            printf ("%-16s %-6s %10.2f %10.2f %10.2f %10.2f %6d\n", name, latency_names[kind],
+                    latency[LATENCY_EVENTS / 2], latency[LATENCY_EVENTS * 9 / 10],
+                    latency[LATENCY_EVENTS * 99 / 100], latency[LATENCY_EVENTS - 1], lost);
+            settle ();
+        }
+    }
+
+    game_quit ();
+    heatmap_quit ();
+    video_quit ();
+    return 0;
+}
+
+int
+bench_run (const char *name, const char *serve_path)
+{
+    if (strcmp (name, "counts") == 0)
+        return bench_counts ();
+    if (strcmp (name, "bbbv") == 0)
+        return bench_bbbv ();
+    if (strcmp (name, "serve") == 0)
+        return bench_serve (serve_path);
+    if (strcmp (name, "latency") == 0)
+        return bench_latency ();
+
+    printf ("Unknown benchmark '%s', expected 'counts', 'bbbv', 'serve' or 'latency'.\n", name);
+    return 1;
+}
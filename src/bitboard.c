@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "bitboard.h"
+#include "util.h"
+#include "mem.h"
+
+// Popcounts of all 3-bit numbers, with 2 bits each.
+#define POPCOUNT3 0xe994u
+
+#define BYTES_1   0x0101010101010101u
+#define BYTES_7F  0x7f7f7f7f7f7f7f7fu
+#define GATHER    0x0102040810204080u       // Moves bit 0 of byte k to bit 56 + k.
+
+void
+bitboard_free (struct bitboard *bb)
+{
+    free (bb->mines);
+    mem_account (MEM_BOARD, -(ptrdiff_t)bb->size);
+    bb->mines = bb->zeros = NULL;
+    bb->size = 0;
+}
+
+void
+bitboard_resize (struct bitboard *bb, int width, int height)
+{
+    const size_t stride = ((size_t)width + 63) / 64;
+    const size_t size = 2 * stride * height * sizeof (uint64_t);
+
+    if (size > bb->size) {
+        bitboard_free (bb);
+        bb->mines = malloc (size);
+        if (!bb->mines) {
+            perror ("malloc()");
+            abort ();
+        }
+        mem_account (MEM_BOARD, size);
+        bb->size = size;
+    }
+    bb->zeros = bb->mines + stride * height;
+    bb->width = width;
+    bb->height = height;
+    bb->stride = stride;
+}
+
+void
+bitboard_pack (uint64_t *row, const unsigned char *bytes, int width, unsigned char value)
+{
+    for (int i = 0; i < width; i += 64) {
+        const int n = my_min (width - i, 64);
+        uint64_t word = 0;
+        int j = 0;
+
+        // Eight bytes at a time: the bytes that equal `value` become zero,
+        // then 1, and the multiplication gathers them into the top byte.
+        for (; j + 8 <= n; j += 8) {
+            uint64_t v;
+            memcpy (&v, bytes + i + j, sizeof v);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            v = __builtin_bswap64 (v);
+#endif
+            v ^= BYTES_1 * value;
+            v = ~(((v & BYTES_7F) + BYTES_7F) | v) >> 7 & BYTES_1;
+            word |= (v * GATHER >> 56) << j;
+        }
+        for (; j < n; ++j)
+            word |= (uint64_t)(bytes[i + j] == value) << j;
+        row[i / 64] = word;
+    }
+}
+
+// Bits x - 1, x and x + 1 of a row, which may span two words.
+static unsigned
+window (const struct bitboard *bb, const uint64_t *row, int x)
+{
+    size_t i, shift;
+    uint64_t bits;
+
+    if (x == 0)
+        return (row[0] << 1) & 7;
+
+    i = (size_t)(x - 1) / 64;
+    shift = (size_t)(x - 1) % 64;
+    bits = row[i] >> shift;
+    if (shift > 61 && i + 1 < bb->stride)
+        bits |= row[i + 1] << (64 - shift);
+    return bits & 7;
+}
+
+unsigned
+bitboard_count (const struct bitboard *bb, int x, int y)
+{
+    unsigned n = 0;
+
+    for (int r = y > 0 ? y - 1 : 0; r <= y + 1 && r < bb->height; ++r)
+        n += (POPCOUNT3 >> (2 * window (bb, bitboard_row (bb, bb->mines, r), x))) & 3;
+    return n;
+}
@@ -0,0 +1,680 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <sys/statvfs.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include "board.h"
+#include "util.h"
+#include "pool.h"
+#include "mem.h"
+
+// The tiles are mapped, so that clearing a large board only has to drop
+// its pages, and a board can be kept in a file, if it exceeds the memory.
+#define TILE_HUGE_PAGE   (2 << 20)          // Mappings of this size are aligned for transparent huge pages.
+#define TILE_RELEASE_MIN (1 << 20)          // Smaller boards are cleared with memset().
+
+static void
+tile_changed (struct bsw_board *b, const struct tile *t)
+{
+    if (b->n_changes == b->cap_changes) {
+        const size_t cap = b->cap_changes ? b->cap_changes * 2 : 256;
+        size_t *new_changes = realloc (b->changes, cap * sizeof (size_t));
+        if (!new_changes) {
+            perror ("realloc()");
+            abort ();
+        }
+        mem_account (MEM_BUFFERS, (cap - b->cap_changes) * sizeof (size_t));
+        b->changes = new_changes;
+        b->cap_changes = cap;
+    }
+    b->changes[b->n_changes++] = bsw_index (b, t);
+}
+
+void
+bsw_clear_changes (struct bsw_board *b)
+{
+    b->n_changes = 0;
+}
+
+static void
+cancel_reveal (struct bsw_board *b)
+{
+    b->frontier_head = b->frontier_len = 0;
+    b->sweep_pos = b->sweep_end = 0;
+    b->revealing = false;
+}
+
+const char *
+bsw_check_size (int64_t width, int64_t height, int64_t mines)
+{
+    if (width < 1 || height < 1 || width > TILE_MAX_SIZE || height > TILE_MAX_SIZE)
+        return "The width and height must be between 1 and 1048576.";
+    if ((uint64_t)width * height > SIZE_MAX / sizeof (struct tile))
+        return "The board is too large for this system.";
+    if (mines < 1 || mines >= width * height)
+        return "There must be at least one bomb and one free tile.";
+    return NULL;
+}
+
+struct bsw_board *
+bsw_new (void)
+{
+    struct bsw_board *b = calloc (1, sizeof *b);
+
+    if (!b) {
+        perror ("calloc()");
+        abort ();
+    }
+    b->tiles_fd = -1;
+    b->rand_state = (unsigned)time (NULL) ^ (unsigned)(uintptr_t)b;
+    return b;
+}
+
+struct tile *
+bsw_tile (const struct bsw_board *b, int x, int y)
+{
+    return (x >= 0 && x < b->width && y >= 0 && y < b->height)
+           ? &b->tiles [(size_t)y * b->width + x] : NULL;
+}
+
+bool
+bsw_is_bomb (const struct bsw_board *b, int x, int y)
+{
+    return b->has_layout && x >= 0 && x < b->width && y >= 0 && y < b->height
+        && layout_is_mine (&b->layout, (size_t)y * b->width + x);
+}
+
+// Same as bsw_is_bomb(), but for placed bombs.
+static bool
+placed_bomb (const struct bsw_board *b, int x, int y)
+{
+    const struct tile *t;
+    return (t = bsw_tile (b, x, y)) != NULL && t->is_bomb;
+}
+
+void
+bsw_next_seed (struct bsw_board *b, unsigned seed)
+{
+    b->next_seed = seed;
+    b->next_seed_set = true;
+}
+
+// Clear the tiles by dropping their pages, returns false if they have to be cleared by hand.
+static bool
+release_tiles (struct bsw_board *b)
+{
+    if (b->tiles_size < TILE_RELEASE_MIN)
+        return false;
+
+    // Shared mappings keep their contents, so the file is cut off and extended again.
+    if (b->tiles_fd >= 0)
+        return ftruncate (b->tiles_fd, 0) == 0 && ftruncate (b->tiles_fd, b->tiles_size) == 0;
+    return madvise (b->tiles, b->tiles_size, MADV_DONTNEED) == 0;
+}
+
+// Forget the moves and the rating of the board.
+static void
+clear_state (struct bsw_board *b)
+{
+    b->n_selected = 0;
+    b->n_flagged = 0;
+    b->bbbv = 0;
+    bbbv_free (&b->rating);
+    bbbv_openings_free (&b->openings);
+    b->generated = false;
+    b->game_over = false;
+    cancel_reveal (b);
+}
+
+void
+bsw_reset (struct bsw_board *b)
+{
+    clear_state (b);
+    b->seed = b->next_seed_set ? b->next_seed : (unsigned)rand_r (&b->rand_state);
+    b->next_seed_set = false;
+    b->has_layout = false;
+
+    b->job = release_tiles (b) ? BSW_JOB_NONE : BSW_JOB_CLEAR;
+    b->job_generate = false;
+    b->job_pos = 0;
+}
+
+void
+bsw_generate (struct bsw_board *b, int nx, int ny)
+{
+    clear_state (b);
+
+    b->job = release_tiles (b) ? BSW_JOB_PLACE : BSW_JOB_CLEAR;
+    b->job_generate = true;
+    b->job_pos = 0;
+    layout_init (&b->layout, bsw_count (b), b->n_bombs, b->seed, (size_t)ny * b->width + nx);
+    b->has_layout = true;
+}
+
+bool
+bsw_work (struct bsw_board *b, size_t budget)
+{
+    const size_t n_tiles = bsw_count (b);
+
+    while (b->job != BSW_JOB_NONE && budget != 0) {
+        switch (b->job) {
+        case BSW_JOB_NONE:
+            break;
+        case BSW_JOB_CLEAR: {
+            const size_t n = my_min (budget, n_tiles - b->job_pos);
+            memset (b->tiles + b->job_pos, 0, n * sizeof (struct tile));
+            b->job_pos += n;
+            budget -= n;
+            if (b->job_pos == n_tiles) {
+                b->job = b->job_generate ? BSW_JOB_PLACE : BSW_JOB_NONE;
+                b->job_pos = 0;
+            }
+            break;
+        }
+        case BSW_JOB_PLACE:
+            // Create bombs, only touching the tiles of the bombs.
+            for (; b->job_pos < b->n_bombs && budget != 0; ++b->job_pos, --budget)
+                b->tiles[layout_mine (&b->layout, b->job_pos)].is_bomb = true;
+            if (b->job_pos == b->n_bombs) {
+                b->job = BSW_JOB_RATE;
+                bbbv_begin (&b->rating, b->tiles, b->width, b->height, &b->openings, &b->bits);
+            }
+            break;
+        case BSW_JOB_RATE:
+            // The neighbouring bombs of the tiles are only stored, once a tile is revealed.
+            if (bbbv_work (&b->rating, &budget)) {
+                b->job = BSW_JOB_NONE;
+                b->bbbv = bbbv_result (&b->rating);
+                b->generated = true;
+                b->start_time = time (NULL);
+                b->start_ms = monotonic_ms ();
+            }
+            break;
+        }
+    }
+    return b->job == BSW_JOB_NONE;
+}
+
+bool
+bsw_busy (const struct bsw_board *b)
+{
+    return b->job != BSW_JOB_NONE;
+}
+
+float
+bsw_progress (const struct bsw_board *b)
+{
+    const int n_steps = b->job_generate ? 3 : 1;
+
+    switch (b->job) {
+    case BSW_JOB_CLEAR:
+        return (float)b->job_pos / bsw_count (b) / n_steps;
+    case BSW_JOB_PLACE:
+        return (1.0f + (float)b->job_pos / b->n_bombs) / n_steps;
+    case BSW_JOB_RATE:
+        return (2.0f + bbbv_progress (&b->rating)) / n_steps;
+    default:
+        return 1.0f;
+    }
+}
+
+bool
+bsw_check_memory (const struct bsw_board *b, int width, int height)
+{
+    size_t needed = mem_board_estimate (width, height);
+    size_t avail = mem_available ();
+
+    // Tiles in a file are paged in and out by the kernel.
+    if (b->tiles_fd >= 0)
+        needed -= (size_t)width * height * sizeof (struct tile);
+
+    // The views of the current board are reused for the new one.
+    if (avail != SIZE_MAX)
+        avail += mem_used (MEM_VIEWS);
+
+    if (needed > avail) {
+        fprintf (stderr, "A %dx%d board needs %zu MiB, but only %zu MiB are available.\n",
+                 width, height, needed >> 20, avail >> 20);
+        return false;
+    }
+    return true;
+}
+
+bool
+bsw_map_file (struct bsw_board *b, const char *path)
+{
+    b->tiles_fd = open (path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (b->tiles_fd < 0) {
+        fprintf (stderr, "Failed to open '%s': %s\n", path, strerror (errno));
+        return false;
+    }
+    return true;
+}
+
+static bool
+check_disk_space (int fd, size_t size)
+{
+    struct statvfs vfs;
+    struct stat st;
+
+    if (fstatvfs (fd, &vfs) != 0 || fstat (fd, &st) != 0)
+        return true;
+
+    // The blocks of the file itself are reused.
+    const uint64_t avail = (uint64_t)vfs.f_bavail * vfs.f_frsize + (uint64_t)st.st_blocks * 512;
+    if (size > avail) {
+        fprintf (stderr, "The board needs %zu MiB on disk, but only %" PRIu64 " MiB are available.\n",
+                 size >> 20, avail >> 20);
+        return false;
+    }
+    return true;
+}
+
+// Map `*size` bytes for the tiles, and round `*size` up to the size of the mapping.
+static struct tile *
+map_tiles (int fd, size_t *size)
+{
+    const size_t page = sysconf (_SC_PAGESIZE);
+    char *base, *start;
+    size_t len;
+
+    *size = (*size + page - 1) & ~(page - 1);
+
+    if (fd >= 0) {
+        if (!check_disk_space (fd, *size))
+            return NULL;
+        if (ftruncate (fd, *size) != 0) {
+            perror ("ftruncate()");
+            return NULL;
+        }
+        base = mmap (NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        return base != MAP_FAILED ? (struct tile *)base : NULL;
+    }
+
+    // Map a bit more and trim it, so the tiles start on a huge page.
+    len = *size >= TILE_HUGE_PAGE ? *size + TILE_HUGE_PAGE : *size;
+    base = mmap (NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+        return NULL;
+    if (len == *size)
+        return (struct tile *)base;
+
+    start = (char *)(((uintptr_t)base + TILE_HUGE_PAGE - 1) & ~(uintptr_t)(TILE_HUGE_PAGE - 1));
+    if (start != base)
+        munmap (base, start - base);
+    if (base + len != start + *size)
+        munmap (start + *size, base + len - (start + *size));
+#ifdef MADV_HUGEPAGE
+    madvise (start, *size, MADV_HUGEPAGE);
+#endif
+    return (struct tile *)start;
+}
+
+// Whether the tiles are a block of the pool, or a mapping of their own.
+static bool
+pooled_tiles (const struct bsw_board *b)
+{
+    return b->pool && b->tiles_size <= POOL_MAX_BLOCK;
+}
+
+static void
+unmap_tiles (struct bsw_board *b)
+{
+    if (!b->tiles)
+        return;
+
+    if (pooled_tiles (b)) {
+        pool_give (b->pool, b->tiles, b->tiles_size);
+    } else {
+        munmap (b->tiles, b->tiles_size);
+        if (b->tiles_fd < 0)
+            mem_account (MEM_BOARD, -(ptrdiff_t)b->tiles_size);
+    }
+    b->tiles = NULL;
+    b->tiles_size = 0;
+}
+
+struct bsw_board *
+bsw_new_in (struct bsw_pool *pool)
+{
+    struct bsw_board *b = pool_take_board (pool);
+
+    if (!b)
+        b = bsw_new ();
+    b->pool = pool;
+    return b;
+}
+
+// Forget everything about a board of a pool, but keep its buffers.
+static void
+recycle (struct bsw_board *b)
+{
+    const struct bsw_board keep = *b;
+
+    unmap_tiles (b);
+    bbbv_free (&b->rating);
+    bbbv_openings_free (&b->openings);
+    memset (b, 0, sizeof *b);
+    b->tiles_fd = -1;
+    b->rand_state = keep.rand_state;
+    b->changes = keep.changes;
+    b->cap_changes = keep.cap_changes;
+    b->frontier = keep.frontier;
+    b->frontier_cap = keep.frontier_cap;
+    b->bits = keep.bits;
+    pool_keep_board (keep.pool, b);
+}
+
+void
+bsw_free (struct bsw_board *b)
+{
+    if (!b)
+        return;
+    if (b->pool) {
+        recycle (b);
+        return;
+    }
+
+    unmap_tiles (b);
+    if (b->tiles_fd >= 0)
+        close (b->tiles_fd);
+    mem_account (MEM_BUFFERS, -(ptrdiff_t)(b->cap_changes * sizeof (size_t) + b->frontier_cap * sizeof (struct tile *)));
+    bbbv_free (&b->rating);
+    bbbv_openings_free (&b->openings);
+    bitboard_free (&b->bits);
+    free (b->changes);
+    free (b->frontier);
+    free (b);
+}
+
+bool
+bsw_resize (struct bsw_board *b, int width, int height, size_t mines)
+{
+    const char *error = bsw_check_size (width, height, mines);
+    size_t size = (size_t)width * height * sizeof (struct tile);
+
+    if (error) {
+        fprintf (stderr, "Invalid board %dx%d with %zu bombs: %s\n", width, height, mines, error);
+        return false;
+    }
+
+    if (!bsw_check_memory (b, width, height))
+        return false;
+
+    // Boards that fit into the current mapping reuse it.
+    if (size > b->tiles_size) {
+        struct tile *new_tiles = NULL;
+        const bool pooled = b->pool && size <= POOL_MAX_BLOCK;
+
+        if (pooled) {
+            new_tiles = pool_take (b->pool, &size);
+        } else {
+            new_tiles = map_tiles (b->tiles_fd, &size);
+        }
+        if (!new_tiles) {
+            fprintf (stderr, "Not enough memory for a %dx%d board (%zu MiB).\n", width, height, size >> 20);
+            return false;
+        }
+
+        unmap_tiles (b);
+        if (!pooled && b->tiles_fd < 0)
+            mem_account (MEM_BOARD, size);
+        b->tiles = new_tiles;
+        b->tiles_size = size;
+    }
+
+    bitboard_resize (&b->bits, width, height);
+    b->width = width;
+    b->height = height;
+    b->n_bombs = mines;
+    bsw_reset (b);
+
+    return true;
+}
+
+unsigned
+bsw_count_bombs (const struct bsw_board *b, int x, int y)
+{
+    unsigned n = 0;
+
+    if (b->generated)
+        return bitboard_count (&b->bits, x, y);
+
+    for (unsigned i = 0; i < 9; ++i)
+        n += placed_bomb (b, x + (-1 + (i / 3)), y + (-1 + (i % 3)));
+    return n;
+}
+
+// Change the status of a tile, keeping track of the flags.
+static void
+set_status (struct bsw_board *b, struct tile *t, enum tile_status status)
+{
+    b->n_flagged += (status == TILE_MARKED) - (t->status == TILE_MARKED);
+    t->status = status;
+}
+
+static void
+reveal_tile (struct bsw_board *b, struct tile *t, unsigned n_bombs)
+{
+    set_status (b, t, TILE_CLICKED);
+    t->n_bombs = n_bombs;
+    if (!t->is_bomb)
+        ++b->n_selected;
+    tile_changed (b, t);
+}
+
+static void
+select_tile (struct bsw_board *b, struct tile *t)
+{
+    if (t->status != TILE_CLICKED)
+        reveal_tile (b, t, bsw_count_bombs (b, bsw_x (b, t), bsw_y (b, t)));
+}
+
+void
+bsw_set_status (struct bsw_board *b, struct tile *t, enum tile_status status)
+{
+    if (t->status == status)
+        return;
+
+    if (status == TILE_CLICKED) {
+        select_tile (b, t);
+    } else {
+        if (t->status == TILE_CLICKED && !t->is_bomb)
+            --b->n_selected;
+        set_status (b, t, status);
+        tile_changed (b, t);
+    }
+}
+
+static void
+push_frontier (struct bsw_board *b, struct tile *t)
+{
+    if (b->frontier_len == b->frontier_cap) {
+        const size_t cap = b->frontier_cap ? b->frontier_cap * 2 : 256;
+        struct tile **new_frontier = realloc (b->frontier, cap * sizeof (struct tile *));
+        if (!new_frontier) {
+            perror ("realloc()");
+            abort ();
+        }
+        mem_account (MEM_BUFFERS, (cap - b->frontier_cap) * sizeof (struct tile *));
+        b->frontier = new_frontier;
+        b->frontier_cap = cap;
+    }
+    b->frontier[b->frontier_len++] = t;
+}
+
+static void
+expand_tile (struct bsw_board *b, struct tile *t)
+{
+    if (!t || t->is_bomb || t->status == TILE_CLICKED)
+        return;
+    select_tile (b, t);
+    if (t->n_bombs == 0)
+        push_frontier (b, t);
+}
+
+// Bits from `start` to `end` (exclusive) of word `i` of a row.
+static uint64_t
+word_mask (size_t i, int start, int end)
+{
+    const int lo = my_max (start - (int)(i * 64), 0);
+    const int hi = my_min (end - (int)(i * 64), 64);
+
+    return (hi == 64 ? ~(uint64_t)0 : ((uint64_t)1 << hi) - 1) & ~(((uint64_t)1 << lo) - 1);
+}
+
+// Reveal the tiles of row `y` from `x0` to `x1` (exclusive) that aren't
+// zeros, skipping the zeros a word at a time.
+static void
+select_numbers (struct bsw_board *b, int y, int x0, int x1)
+{
+    const uint64_t *zeros = bitboard_row (&b->bits, b->bits.zeros, y);
+    struct tile *row = b->tiles + (size_t)y * b->width;
+
+    for (size_t i = x0 / 64; i <= (size_t)(x1 - 1) / 64; ++i) {
+        for (uint64_t word = ~zeros[i] & word_mask (i, x0, x1); word != 0; word &= word - 1)
+            select_tile (b, &row[i * 64 + __builtin_ctzll (word)]);
+    }
+}
+
+// Reveal the zeros of a span, which need no counting, and their border.
+static void
+sweep_span (struct bsw_board *b, const struct bbbv_span *s)
+{
+    const int x0 = s->start > 0 ? s->start - 1 : 0;
+    const int x1 = (int)s->end < b->width ? s->end + 1 : s->end;
+    struct tile *row = b->tiles + (size_t)s->y * b->width;
+
+    for (uint32_t x = s->start; x < s->end; ++x) {
+        if (row[x].status != TILE_CLICKED)
+            reveal_tile (b, &row[x], 0);
+    }
+    if (x0 < (int)s->start)
+        select_tile (b, &row[x0]);
+    if (x1 > (int)s->end)
+        select_tile (b, &row[s->end]);
+
+    // Zeros above and below belong to the same opening, so they are
+    // swept by their own span; only the numbers are revealed here.
+    if (s->y > 0)
+        select_numbers (b, s->y - 1, x0, x1);
+    if ((int)s->y + 1 < b->height)
+        select_numbers (b, s->y + 1, x0, x1);
+}
+
+// Start the cascade of a zero, from the index if there is one.
+static void
+start_cascade (struct bsw_board *b, struct tile *t)
+{
+    const size_t k = bbbv_opening_at (&b->openings, bsw_x (b, t), bsw_y (b, t));
+
+    if (k == SIZE_MAX) {
+        push_frontier (b, t);
+    } else if (!b->openings.swept[k]) {
+        b->openings.swept[k] = true;
+        b->sweep_pos = b->openings.first[k];
+        b->sweep_end = b->openings.first[k + 1];
+    }
+}
+
+static void
+end_game (struct bsw_board *b)
+{
+    b->game_over = true;
+    b->end_time = time (NULL);
+    b->end_ms = monotonic_ms ();
+}
+
+bool
+bsw_reveal (struct bsw_board *b, size_t budget)
+{
+    if (!b->revealing)
+        return true;
+
+    while (b->sweep_pos != b->sweep_end && budget != 0) {
+        const struct bbbv_span *s = &b->openings.spans[b->openings.members[b->sweep_pos++]];
+        sweep_span (b, s);
+        budget -= my_min (budget, (size_t)(s->end - s->start));
+    }
+
+    while (b->frontier_head != b->frontier_len && budget-- != 0) {
+        const struct tile *t = b->frontier[b->frontier_head++];
+        const int x = bsw_x (b, t), y = bsw_y (b, t);
+        expand_tile (b, bsw_tile (b, x - 1, y - 1));
+        expand_tile (b, bsw_tile (b, x    , y - 1));
+        expand_tile (b, bsw_tile (b, x + 1, y - 1));
+        expand_tile (b, bsw_tile (b, x - 1, y    ));
+        expand_tile (b, bsw_tile (b, x + 1, y    ));
+        expand_tile (b, bsw_tile (b, x - 1, y + 1));
+        expand_tile (b, bsw_tile (b, x    , y + 1));
+        expand_tile (b, bsw_tile (b, x + 1, y + 1));
+    }
+
+    if (b->sweep_pos != b->sweep_end || b->frontier_head != b->frontier_len)
+        return false;
+
+    // The cascade is complete, so it's safe to check for a win now.
+    cancel_reveal (b);
+    if (bsw_all_selected (b))
+        end_game (b);
+    return true;
+}
+
+bool
+bsw_revealing (const struct bsw_board *b)
+{
+    return b->revealing;
+}
+
+void
+bsw_click (struct bsw_board *b, struct tile *t)
+{
+    select_tile (b, t);
+    if (t->is_bomb) {
+        end_game (b);
+    } else {
+        if (t->n_bombs == 0)
+            start_cascade (b, t);
+        b->revealing = true;
+    }
+}
+
+void
+bsw_flag (struct bsw_board *b, struct tile *t)
+{
+    switch (t->status) {
+    case TILE_NONE:
+        set_status (b, t, TILE_MARKED);
+        break;
+    case TILE_MARKED:
+        set_status (b, t, TILE_MARKED2);
+        break;
+    case TILE_MARKED2:
+        set_status (b, t, TILE_NONE);
+        break;
+    case TILE_CLICKED:
+        return;
+    }
+    tile_changed (b, t);
+}
@@ -0,0 +1,263 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Batch protocol for bots.
+ *
+ * Every line on stdin is one command:
+ *
+ *   n <width> <height> <mines> [<seed>]   Start a new game.
+ *   r <x> <y>                             Reveal a tile.
+ *   f <x> <y>                             Cycle the flag of a tile.
+ *   m <x> <y> [<x> <y>]...                Reveal many tiles.
+ *
+ * Every command is answered by one line with the state of the game ('p' for
+ * playing, 'w' for won, 'l' for lost), the number of tiles revealed by the
+ * command and their "<x> <y> <count>", where the count is 9 for a mine:
+ *
+ *   p 2 3 4 1 3 5 2
+ *
+ * Invalid commands are answered with "e <message>". The answers of all
+ * commands read at once are written at once, so the cost of a system call is
+ * shared by a whole batch.
+ */
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include "board.h"
+#include "wire.h"
+#include "bot.h"
+#include "mem.h"
+#include "bsw.h"
+
+static void
+put_str (struct buffer *out, const char *s)
+{
+    buf_put (out, s, strlen (s));
+}
+
+static void
+put_uint (struct buffer *out, uint64_t v)
+{
+    char buf[24], *p = buf + sizeof buf;
+
+    do {
+        *--p = '0' + v % 10;
+        v /= 10;
+    } while (v != 0);
+    buf_put_u8 (out, ' ');
+    buf_put (out, p, buf + sizeof buf - p);
+}
+
+static bool
+parse_int (char **s, int64_t *v)
+{
+    char *end;
+
+    *v = strtoll (*s, &end, 10);
+    if (end == *s)
+        return false;
+    *s = end;
+    return true;
+}
+
+// Answer with the state of the game and all tiles revealed since the last answer.
+static void
+put_result (struct bsw_board *b, struct buffer *out)
+{
+    size_t n = 0;
+
+    for (size_t i = 0; i < b->n_changes; ++i)
+        n += b->tiles[b->changes[i]].status == TILE_CLICKED;
+
+    buf_put_u8 (out, !b->game_over ? 'p' : bsw_all_selected (b) ? 'w' : 'l');
+    put_uint (out, n);
+    for (size_t i = 0; i < b->n_changes; ++i) {
+        const size_t idx = b->changes[i];
+        const struct tile *t = &b->tiles[idx];
+        if (t->status != TILE_CLICKED)
+            continue;
+        put_uint (out, idx % b->width);
+        put_uint (out, idx / b->width);
+        put_uint (out, t->is_bomb ? 9 : t->n_bombs);
+    }
+    buf_put_u8 (out, '\n');
+    bsw_clear_changes (b);
+}
+
+static bool
+new_game (struct bsw_board *b, struct buffer *out, char *args, size_t max_tiles)
+{
+    int64_t width, height, mines, seed;
+
+    if (!parse_int (&args, &width) || !parse_int (&args, &height) || !parse_int (&args, &mines)
+        || bsw_check_size (width, height, mines) || (uint64_t)width * height > max_tiles) {
+        put_str (out, "e invalid board\n");
+        return false;
+    }
+
+    // Reuse the board, if the size didn't change. The memory of boards
+    // without a file is checked here, so bsw_resize() doesn't complain on
+    // stderr about every bot.
+    if (b->tiles && width == b->width && height == b->height) {
+        b->n_bombs = (size_t)mines;
+        bsw_reset (b);
+    } else if ((b->tiles_fd < 0 && mem_board_estimate (width, height) > mem_available ())
+               || !bsw_resize (b, width, height, mines)) {
+        put_str (out, "e out of memory\n");
+        return false;
+    }
+    if (parse_int (&args, &seed))
+        b->seed = seed;
+    bsw_work (b, (size_t)-1);
+    bsw_clear_changes (b);
+    return true;
+}
+
+static struct tile *
+bot_tile (const struct bsw_board *b, int64_t x, int64_t y)
+{
+    return x >= 0 && x < b->width && y >= 0 && y < b->height ? bsw_tile (b, x, y) : NULL;
+}
+
+static void
+reveal (struct bsw_board *b, int64_t x, int64_t y)
+{
+    struct tile *t = bot_tile (b, x, y);
+
+    if (b->game_over || !t)
+        return;
+    if (!b->generated) {
+        bsw_generate (b, x, y);
+        bsw_work (b, (size_t)-1);
+    }
+
+    bsw_click (b, t);
+    bsw_reveal (b, (size_t)-1);
+}
+
+static void
+handle_line (struct bsw_board *b, struct buffer *out, char *line, size_t max_tiles)
+{
+    const char cmd = *line++;
+    int64_t x, y;
+
+    if (cmd != 'n' && !b->tiles) {
+        put_str (out, "e no game\n");
+        return;
+    }
+
+    switch (cmd) {
+    case 'n':
+        if (new_game (b, out, line, max_tiles))
+            put_result (b, out);
+        break;
+    case 'r':
+        if (!parse_int (&line, &x) || !parse_int (&line, &y)) {
+            put_str (out, "e expected <x> <y>\n");
+            break;
+        }
+        reveal (b, x, y);
+        put_result (b, out);
+        break;
+    case 'f':
+        if (!parse_int (&line, &x) || !parse_int (&line, &y)) {
+            put_str (out, "e expected <x> <y>\n");
+            break;
+        }
+        if (!b->game_over && bot_tile (b, x, y))
+            bsw_flag (b, bot_tile (b, x, y));
+        put_result (b, out);
+        break;
+    case 'm':
+        while (parse_int (&line, &x) && parse_int (&line, &y))
+            reveal (b, x, y);
+        put_result (b, out);
+        break;
+    default:
+        put_str (out, "e unknown command\n");
+        break;
+    }
+}
+
+void
+bot_handle (struct bsw_board *b, struct buffer *in, struct buffer *out, size_t max_tiles)
+{
+    unsigned char *line = in->data, *end;
+
+    while ((end = memchr (line, '\n', in->data + in->len - line))) {
+        *end = '\0';
+        if (end != line)
+            handle_line (b, out, (char *)line, max_tiles);
+        line = end + 1;
+    }
+    buf_consume (in, line - in->data);
+}
+
+static bool
+flush_output (struct buffer *out)
+{
+    size_t pos = 0;
+
+    while (pos < out->len) {
+        const ssize_t n = write (STDOUT_FILENO, out->data + pos, out->len - pos);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            perror ("write()");
+            return false;
+        }
+        pos += n;
+    }
+    out->len = 0;
+    return true;
+}
+
+int
+bot_run (void)
+{
+    struct buffer in = { 0 }, out = { 0 };
+    ssize_t n;
+
+    do {
+        buf_reserve (&in, 1 << 16);
+        n = read (STDIN_FILENO, in.data + in.len, in.cap - in.len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            perror ("read()");
+            break;
+        }
+        in.len += n;
+
+        // Terminate the last line at the end of the input.
+        if (n == 0 && in.len != 0 && in.data[in.len - 1] != '\n')
+            buf_put_u8 (&in, '\n');
+
+        bot_handle (board, &in, &out, SIZE_MAX);
+    } while (n != 0 && flush_output (&out));
+
+    flush_output (&out);
+    buf_free (&in);
+    buf_free (&out);
+    bsw_free (board);
+    board = NULL;
+    return 0;
+}
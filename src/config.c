@@ -14,6 +14,7 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <inttypes.h>
 #include <libgen.h>
 #include <string.h>
 #include <stdio.h>
@@ -23,7 +24,7 @@
 #include "tile.h"
 #include "bsw.h"
 
-int default_n_mines     = 10;
+int64_t default_n_mines = 10;
 int default_width       = 10;
 int default_height      = 10;
 bool first_launch       = false;
@@ -37,29 +38,29 @@ int default_presets[3][3] = {
 #define read_val_int(x)                                                 \
 x = toml_int_in (game, #x);                                             \
 if (x.ok) {                                                             \
-    default_##x = (int)x.u.i;                                           \
+    default_##x = (__typeof__ (default_##x))x.u.i;                      \
 } else {                                                                \
     fprintf (stderr, "Missing field 'Games.%s' in '%s'", #x, filename); \
 }
 
 char *
-make_filename (void)
+config_path (const char *name)
 {
     char *xdg_config = getenv ("XDG_CONFIG_DIR");
     if (xdg_config) {
-        const char suffix[] = "billig-sweeper/config.toml";
-        const size_t len = strlen (xdg_config) + sizeof suffix + 3;
+        const char suffix[] = "billig-sweeper";
+        const size_t len = strlen (xdg_config) + sizeof suffix + strlen (name) + 3;
         char *filename = malloc (len);
-        snprintf (filename, len, "%s/%s", xdg_config, suffix);
+        snprintf (filename, len, "%s/%s/%s", xdg_config, suffix, name);
         return filename;
     }
 
     char *home = getenv ("HOME");
     if (home) {
-        const char suffix[] = ".config/billig-sweeper/config.toml";
-        const size_t len = strlen (home) + sizeof suffix + 3;
+        const char suffix[] = ".config/billig-sweeper";
+        const size_t len = strlen (home) + sizeof suffix + strlen (name) + 3;
         char *filename = malloc (len);
-        snprintf (filename, len, "%s/%s", home, suffix);
+        snprintf (filename, len, "%s/%s/%s", home, suffix, name);
         return filename;
     }
 
@@ -70,7 +71,7 @@ make_filename (void)
 void
 load_settings (void)
 {
-    char *filename = make_filename ();
+    char *filename = config_path ("config.toml");
     FILE *file = fopen (filename, "r");
     if (!file) {
         first_launch = true;
@@ -147,7 +148,7 @@ end:
 void
 save_settings (void)
 {
-    char *filename = make_filename ();
+    char *filename = config_path ("config.toml");
 
     char *dup = strdup (filename);
     dirname (dup);
@@ -161,7 +162,7 @@ save_settings (void)
         return;
     }
     fputs ("[Game]\n", file);
-    fprintf (file, "\tn_mines = %d\n", default_n_mines);
+    fprintf (file, "\tn_mines = %" PRId64 "\n", default_n_mines);
     fprintf (file, "\twidth = %d\n", default_width);
     fprintf (file, "\theight = %d\n", default_height);
     fprintf (file, "\tcolor = [ %d, %d, %d ]\n", default_color.r, default_color.g, default_color.b);
@@ -0,0 +1,271 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * Streaming PNG export of the whole board.
+ *
+ * A board can have gigapixels, so the image is never held in memory. The
+ * export thread composites one row of pixels at a time from the tile atlas
+ * and feeds it to zlib. Every filled output buffer becomes an IDAT chunk.
+ * Apart from a copy of the tiles, the memory is bounded by a single row.
+ * An export is refused when that copy doesn't fit into the available memory.
+ */
+#include <SDL2/SDL_thread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <zlib.h>
+#include "export.h"
+#include "tile.h"
+#include "util.h"
+#include "mem.h"
+#include "bsw.h"
+
+#define EXPORT_CHUNK (256 << 10)            // Size of the IDAT chunks.
+
+struct png {
+    FILE *file;
+    z_stream zs;
+    unsigned char out[EXPORT_CHUNK];
+};
+
+// Every sprite of the atlas as RGB, indexed by [sprite][y].
+static unsigned char sprites[N_TILE_SPRITES][EXPORT_TILE_SIZE][EXPORT_TILE_SIZE * 3];
+
+static SDL_Thread *thread;
+static atomic_bool running, cancel;
+
+// The board being exported, owned by the export thread while it runs.
+static unsigned char *job_tiles;
+static int job_width, job_height;
+static bool job_show_mines;
+static char job_path[64];
+
+void
+export_init (SDL_Surface *atlas)
+{
+    SDL_Surface *rgb = SDL_ConvertSurfaceFormat (atlas, SDL_PIXELFORMAT_RGB24, 0);
+
+    if (!rgb) {
+        printf ("Failed to convert the tile atlas for exports: %s\n", SDL_GetError ());
+        return;
+    }
+
+    SDL_LockSurface (rgb);
+    for (int i = 0; i < N_TILE_SPRITES; ++i) {
+        for (int y = 0; y < EXPORT_TILE_SIZE; ++y) {
+            const unsigned char *row = (const unsigned char *)rgb->pixels + (size_t)y * rgb->pitch;
+            memcpy (sprites[i][y], row + i * EXPORT_TILE_SIZE * 3, EXPORT_TILE_SIZE * 3);
+        }
+    }
+    SDL_UnlockSurface (rgb);
+    SDL_FreeSurface (rgb);
+}
+
+static void
+put_u32 (unsigned char *p, uint32_t x)
+{
+    p[0] = x >> 24;
+    p[1] = x >> 16;
+    p[2] = x >> 8;
+    p[3] = x;
+}
+
+static bool
+write_chunk (FILE *file, const char *type, const unsigned char *data, size_t len)
+{
+    unsigned char hdr[8], crc[4];
+
+    put_u32 (hdr, len);
+    memcpy (hdr + 4, type, 4);
+    put_u32 (crc, len == 0 ? crc32 (0, hdr + 4, 4) : crc32 (crc32 (0, hdr + 4, 4), data, len));
+    return fwrite (hdr, sizeof hdr, 1, file) == 1
+        && (len == 0 || fwrite (data, len, 1, file) == 1)
+        && fwrite (crc, sizeof crc, 1, file) == 1;
+}
+
+// Compress `len` bytes of image data, and write every filled output buffer.
+static bool
+png_deflate (struct png *png, const unsigned char *data, size_t len, int flush)
+{
+    int ret;
+
+    png->zs.next_in = (unsigned char *)data;
+    png->zs.avail_in = len;
+    do {
+        ret = deflate (&png->zs, flush);
+        if (ret == Z_STREAM_ERROR)
+            return false;
+
+        if (png->zs.avail_out == 0 || ret == Z_STREAM_END) {
+            const size_t n = sizeof png->out - png->zs.avail_out;
+            if (n != 0 && !write_chunk (png->file, "IDAT", png->out, n))
+                return false;
+            png->zs.next_out = png->out;
+            png->zs.avail_out = sizeof png->out;
+        }
+    } while (png->zs.avail_in != 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+    return true;
+}
+
+static bool
+write_png (struct png *png, unsigned char *row)
+{
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    const size_t stride = 1 + (size_t)job_width * EXPORT_TILE_SIZE * 3;
+    unsigned char ihdr[13];
+
+    // 8-bit RGB, not interlaced.
+    put_u32 (ihdr, (uint32_t)job_width * EXPORT_TILE_SIZE);
+    put_u32 (ihdr + 4, (uint32_t)job_height * EXPORT_TILE_SIZE);
+    ihdr[8] = 8;
+    ihdr[9] = 2;
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+    if (fwrite (signature, sizeof signature, 1, png->file) != 1 || !write_chunk (png->file, "IHDR", ihdr, sizeof ihdr))
+        return false;
+
+    // Every row starts with filter type 0 (none); the tiles repeat often
+    // enough for deflate to find them without a filter.
+    row[0] = 0;
+    for (int y = 0; y < job_height; ++y) {
+        const unsigned char *tiles = job_tiles + (size_t)y * job_width;
+
+        if (atomic_load (&cancel))
+            return false;
+
+        for (int py = 0; py < EXPORT_TILE_SIZE; ++py) {
+            unsigned char *out = row + 1;
+
+            for (int x = 0; x < job_width; ++x) {
+                memcpy (out, sprites[tile_view_sprite (tiles[x], job_show_mines)][py], EXPORT_TILE_SIZE * 3);
+                out += EXPORT_TILE_SIZE * 3;
+            }
+            if (!png_deflate (png, row, stride, Z_NO_FLUSH))
+                return false;
+        }
+    }
+
+    return png_deflate (png, NULL, 0, Z_FINISH) && write_chunk (png->file, "IEND", NULL, 0);
+}
+
+static int
+export_thread (void *arg)
+{
+    const size_t stride = 1 + (size_t)job_width * EXPORT_TILE_SIZE * 3;
+    const uint64_t start = monotonic_ms ();
+    struct png *png = malloc (sizeof *png);
+    unsigned char *row = malloc (stride);
+    bool ok;
+    (void)arg;
+
+    if (!png || !row) {
+        perror ("malloc()");
+        abort ();
+    }
+    mem_account (MEM_BUFFERS, sizeof *png + stride);
+
+    memset (&png->zs, 0, sizeof png->zs);
+    png->file = fopen (job_path, "wb");
+    if (!png->file) {
+        printf ("Failed to open '%s': %s\n", job_path, strerror (errno));
+        ok = false;
+    } else if (deflateInit (&png->zs, Z_BEST_SPEED) != Z_OK) {
+        printf ("Failed to initialize zlib.\n");
+        fclose (png->file);
+        ok = false;
+    } else {
+        png->zs.next_out = png->out;
+        png->zs.avail_out = sizeof png->out;
+        ok = write_png (png, row);
+        deflateEnd (&png->zs);
+        if (fclose (png->file) != 0)
+            ok = false;
+        if (!ok) {
+            if (!atomic_load (&cancel))
+                printf ("Failed to write '%s': %s\n", job_path, strerror (errno));
+            remove (job_path);
+        }
+    }
+
+    if (ok)
+        printf ("Exported the board to '%s' in %.1f s.\n", job_path, (monotonic_ms () - start) / 1000.0);
+
+    mem_account (MEM_BUFFERS, -(ptrdiff_t)(sizeof *png + stride + (size_t)job_width * job_height));
+    free (row);
+    free (png);
+    free (job_tiles);
+    job_tiles = NULL;
+    atomic_store (&running, false);
+    return 0;
+}
+
+bool
+export_start (const struct board_view *v)
+{
+    const size_t n_tiles = (size_t)v->width * v->height;
+    const time_t now = time (NULL);
+
+    if (atomic_load (&running)) {
+        puts ("An export is already running.");
+        return false;
+    }
+    if (thread) {
+        SDL_WaitThread (thread, NULL);
+        thread = NULL;
+    }
+
+    // The view changes with the next frame, so the thread gets its own copy.
+    // Running out of memory for it must not take the game down.
+    if (n_tiles > mem_available () || !(job_tiles = malloc (n_tiles))) {
+        printf ("Not enough memory to export the board, it needs %zu MiB.\n", n_tiles >> 20);
+        return false;
+    }
+    mem_account (MEM_BUFFERS, n_tiles);
+    memcpy (job_tiles, v->tiles, n_tiles);
+    job_width = v->width;
+    job_height = v->height;
+    job_show_mines = v->game_over;
+    strftime (job_path, sizeof job_path, "billig-sweeper-%Y%m%d-%H%M%S.png", localtime (&now));
+
+    printf ("Exporting the board to '%s'.\n", job_path);
+    atomic_store (&cancel, false);
+    atomic_store (&running, true);
+    thread = SDL_CreateThread (&export_thread, "export", NULL);
+    if (!thread) {
+        printf ("Failed to create export thread: %s\n", SDL_GetError ());
+        atomic_store (&running, false);
+        mem_account (MEM_BUFFERS, -(ptrdiff_t)n_tiles);
+        free (job_tiles);
+        job_tiles = NULL;
+        return false;
+    }
+    return true;
+}
+
+void
+export_quit (void)
+{
+    if (!thread)
+        return;
+
+    atomic_store (&cancel, true);
+    SDL_WaitThread (thread, NULL);
+    thread = NULL;
+}
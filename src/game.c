@@ -0,0 +1,636 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The game logic runs on its own thread, so that expensive moves on huge
+ * boards never block input handling or rendering on the main thread.
+ *
+ * The main thread sends commands through a small queue. After each burst of
+ * commands the game thread publishes a snapshot of the board through a
+ * lock-free triple buffer: the game thread owns the `back` buffer, the main
+ * thread owns the `front` buffer, and the two swap their buffer with `middle`.
+ * Each buffer remembers which tiles changed since it was last written, so
+ * publishing only copies the tiles that actually changed.
+ *
+ * Cascades are revealed in slices of REVEAL_BUDGET_MS, with a snapshot
+ * published after each slice, so huge openings spread out as a wave.
+ * Clearing and generating the board runs in the same slices, but only its
+ * progress is published until the board is ready. The click that started
+ * the generation is applied afterwards, and a reset or resize cancels it.
+ */
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "spectate.h"
+#include "history.h"
+#include "journal.h"
+#include "heatmap.h"
+#include "video.h"
+#include "game.h"
+#include "tile.h"
+#include "util.h"
+#include "mem.h"
+#include "net.h"
+#include "bsw.h"
+
+#define QUEUE_SIZE 256
+#define VIEW_FRESH 0x04
+#define REVEAL_BUDGET_MS 15                 // Time spent on a cascade before publishing a frame.
+#define REVEAL_CHUNK 1024                   // Tiles revealed between checks of the clock.
+#define WORK_CHUNK (1 << 16)                // Tiles cleared or generated between checks of the clock.
+
+static SDL_Thread *thread;
+static SDL_mutex *queue_mutex;
+static SDL_cond *queue_cond;
+static SDL_cond *queue_space;
+static struct game_cmd queue[QUEUE_SIZE];
+static size_t queue_head, queue_len;
+static bool quit_requested;
+
+static struct board_view views[3];
+static atomic_int middle = 1;               // Latest published view, or'ed with VIEW_FRESH if unread.
+static int back = 2;                        // Owned by the game thread.
+static int front = 0;                       // Owned by the main thread.
+static atomic_int redraw_queued;
+static atomic_int progress = -1;            // Of the running board job in permille, or -1.
+static bool recorded;                       // The result of the current game was recorded.
+static int first_x, first_y;                // The click that generated the board.
+static int first_button;                    // Button of the click waiting for the board, or 0.
+static size_t n_clicks;                     // Clicks on the tiles of the current board.
+
+static void
+push_user_event (int code)
+{
+    SDL_Event e;
+    SDL_zero (e);
+    e.user.type = SDL_USEREVENT;
+    e.user.code = code;
+    SDL_PushEvent (&e);
+}
+
+static void
+invalidate_views (void)
+{
+    for (int i = 0; i < 3; ++i)
+        views[i].full_refresh = true;
+    bsw_clear_changes (board);
+}
+
+static void
+view_add_pending (struct board_view *v, const size_t *idx, size_t n)
+{
+    if (v->full_refresh || n == 0)
+        return;
+
+    // Copying the whole board is cheaper than replaying a huge list.
+    if (v->n_pending + n > bsw_count (board) / 8) {
+        v->full_refresh = true;
+        return;
+    }
+
+    if (v->n_pending + n > v->cap_pending) {
+        const size_t cap = my_max (v->cap_pending * 2, v->n_pending + n);
+        size_t *pending = realloc (v->pending, cap * sizeof (size_t));
+        if (!pending) {
+            v->full_refresh = true;
+            return;
+        }
+        mem_account (MEM_VIEWS, (cap - v->cap_pending) * sizeof (size_t));
+        v->pending = pending;
+        v->cap_pending = cap;
+    }
+    memcpy (v->pending + v->n_pending, idx, n * sizeof (size_t));
+    v->n_pending += n;
+}
+
+static void
+view_sync (struct board_view *v)
+{
+    const size_t n = bsw_count (board);
+
+    if (v->width != board->width || v->height != board->height || !v->tiles) {
+        unsigned char *new_tiles = realloc (v->tiles, n);
+        if (!new_tiles) {
+            perror ("realloc()");
+            abort ();
+        }
+        mem_account (MEM_VIEWS, (ptrdiff_t)n - (v->tiles ? (ptrdiff_t)v->width * v->height : 0));
+        v->tiles = new_tiles;
+        v->width = board->width;
+        v->height = board->height;
+        v->full_refresh = true;
+    }
+
+    if (v->full_refresh) {
+        for (size_t i = 0; i < n; ++i)
+            v->tiles[i] = tile_view (&board->tiles[i]);
+    } else {
+        for (size_t i = 0; i < v->n_pending; ++i)
+            v->tiles[v->pending[i]] = tile_view (&board->tiles[v->pending[i]]);
+        for (size_t i = 0; i < board->n_changes; ++i)
+            v->tiles[board->changes[i]] = tile_view (&board->tiles[board->changes[i]]);
+    }
+
+    v->n_pending = 0;
+    v->full_refresh = false;
+}
+
+// Wake up the main thread, unless it already has a redraw queued.
+static void
+request_redraw (void)
+{
+    int expected = 0;
+    if (atomic_compare_exchange_strong (&redraw_queued, &expected, 1))
+        push_user_event (EV_REDRAW);
+}
+
+static void
+publish (void)
+{
+    struct board_view *v = &views[back];
+
+    view_sync (v);
+    for (int i = 0; i < 3; ++i) {
+        if (i != back)
+            view_add_pending (&views[i], board->changes, board->n_changes);
+    }
+
+    v->n_bombs = board->n_bombs;
+    v->n_selected = board->n_selected;
+    v->n_flagged = board->n_flagged;
+    v->bbbv = board->bbbv;
+    v->n_clicks = n_clicks;
+    v->generated = board->generated;
+    v->seed = board->seed;
+    v->game_over = board->game_over;
+    v->start_ms = board->start_ms;
+    v->end_ms = board->end_ms;
+
+    net_send_delta (-1, board->changes, board->n_changes);
+    spectate_delta (board->changes, board->n_changes);
+    bsw_clear_changes (board);
+    heatmap_update (v);
+
+    back = atomic_exchange (&middle, back | VIEW_FRESH) & ~VIEW_FRESH;
+    atomic_store (&progress, -1);
+    request_redraw ();
+}
+
+// While the board is being cleared or generated, the last board stays
+// visible and only the progress is updated.
+static void
+publish_progress (void)
+{
+    atomic_store (&progress, bsw_progress (board) * 1000);
+    request_redraw ();
+}
+
+// Record the result, once the game has ended.
+static void
+check_game_end (void)
+{
+    if (!board->game_over || recorded)
+        return;
+
+    const bool won = bsw_all_selected (board);
+    const struct history_record r = {
+        .date = board->end_time,
+        .n_mines = board->n_bombs,
+        .width = board->width,
+        .height = board->height,
+        .seed = board->seed,
+        .time_ms = board->end_ms - board->start_ms,
+        .flags = won ? HISTORY_WON : 0,
+        .bbbv = my_min (board->bbbv, UINT32_MAX),
+    };
+
+    recorded = true;
+    if (!spectating)
+        history_add (&r);
+    journal_clear ();
+    if (!won)
+        push_user_event (EV_GAME_LOST);
+}
+
+// Journal a move, unless it can't change anything.
+static void
+click (struct tile *t, int which)
+{
+    if (which != SDL_BUTTON_LEFT && which != SDL_BUTTON_RIGHT)
+        return;
+
+    ++n_clicks;
+    if (t->status != TILE_CLICKED)
+        journal_move (bsw_x (board, t), bsw_y (board, t), which);
+    if (which == SDL_BUTTON_LEFT) {
+        bsw_click (board, t);
+    } else if (which == SDL_BUTTON_RIGHT) {
+        bsw_flag (board, t);
+    }
+}
+
+// Tell co-op clients and spectators about a new board.
+static void
+send_board (void)
+{
+    net_send_board (-1, first_x, first_y);
+    spectate_board (first_x, first_y);
+}
+
+static void
+apply_remote_board (const struct net_board *b)
+{
+    if (bsw_check_size (b->width, b->height, b->n_mines)) {
+        fputs ("Ignoring invalid remote board.\n", stderr);
+        return;
+    }
+    if (!bsw_resize (board, b->width, b->height, b->n_mines))
+        return;
+
+    // Same seed and first click give the same mines as on the host.
+    board->seed = b->seed;
+    first_x = b->first_x;
+    first_y = b->first_y;
+    first_button = 0;
+    if (b->generated) {
+        bsw_generate (board, b->first_x, b->first_y);
+    } else {
+        send_board ();
+    }
+
+    recorded = false;
+}
+
+static void
+apply_remote_delta (const struct net_delta *d)
+{
+    const size_t n_tiles = bsw_count (board);
+
+    for (size_t i = 0; i < d->n; ++i) {
+        if (d->tiles[i].index < n_tiles)
+            bsw_set_status (board, &board->tiles[d->tiles[i].index], d->tiles[i].status);
+    }
+
+    if (d->game_over && !board->game_over) {
+        board->game_over = true;
+        board->end_time = time (NULL);
+        board->end_ms = monotonic_ms ();
+    }
+    check_game_end ();
+}
+
+static void
+game_exec (const struct game_cmd *cmd)
+{
+    struct tile *t;
+
+    switch (cmd->type) {
+    case GAME_CMD_CLICK:
+        if (board->game_over || !(t = bsw_tile (board, cmd->x, cmd->y)))
+            break;
+
+        // The first click is applied, once the board has been generated.
+        if (!board->generated) {
+            first_x = cmd->x;
+            first_y = cmd->y;
+            first_button = cmd->arg;
+            bsw_generate (board, cmd->x, cmd->y);
+            break;
+        }
+
+        click (t, cmd->arg);
+        check_game_end ();
+        break;
+    case GAME_CMD_RESET:
+        recorded = false;
+        first_button = 0;
+        journal_clear ();
+        bsw_reset (board);
+        send_board ();
+        break;
+    case GAME_CMD_RESIZE:
+        if (!bsw_resize (board, cmd->x, cmd->y, cmd->arg))
+            break;
+        recorded = false;
+        first_button = 0;
+        journal_clear ();
+        send_board ();
+        break;
+    case GAME_CMD_SYNC:
+        net_sync (cmd->arg, first_x, first_y);
+        break;
+    case GAME_CMD_REMOTE_BOARD:
+        apply_remote_board (cmd->data);
+        break;
+    case GAME_CMD_REMOTE_DELTA:
+        apply_remote_delta (cmd->data);
+        break;
+    }
+    free (cmd->data);
+}
+
+// The board is ready; show it and apply the click that generated it.
+static void
+finish_job (void)
+{
+    struct tile *t;
+
+    invalidate_views ();
+    if (!board->generated)
+        return;
+
+    send_board ();
+    journal_begin (board, first_x, first_y);
+    n_clicks = 0;
+    if (first_button && (t = bsw_tile (board, first_x, first_y))) {
+        click (t, first_button);
+        check_game_end ();
+    }
+    first_button = 0;
+}
+
+// Continue a running board job or cascade for one frame, and show the progress so far.
+static void
+work_frame (void)
+{
+    const Uint32 start = SDL_GetTicks ();
+
+    if (bsw_busy (board)) {
+        while (!bsw_work (board, WORK_CHUNK) && SDL_GetTicks () - start < REVEAL_BUDGET_MS);
+        if (bsw_busy (board)) {
+            publish_progress ();
+            return;
+        }
+        finish_job ();
+    } else {
+        while (!bsw_reveal (board, REVEAL_CHUNK) && SDL_GetTicks () - start < REVEAL_BUDGET_MS);
+        check_game_end ();
+    }
+    publish ();
+}
+
+// Whether `cmd` can run now. Clicks have to wait for a running cascade, and
+// everything but a new board has to wait for the board to be ready.
+static bool
+cmd_ready (const struct game_cmd *cmd)
+{
+    switch (cmd->type) {
+    case GAME_CMD_CLICK:
+        return !bsw_revealing (board) && !bsw_busy (board);
+    case GAME_CMD_RESET:
+    case GAME_CMD_RESIZE:
+    case GAME_CMD_REMOTE_BOARD:
+        return true;
+    default:
+        return !bsw_busy (board);
+    }
+}
+
+// A new board cancels the clicks that wait in front of it.
+// Must be called with `queue_mutex` locked.
+static void
+drop_waiting_clicks (void)
+{
+    size_t last = queue_len, n = 0;
+
+    for (size_t i = 0; i < queue_len; ++i) {
+        const enum game_cmd_type type = queue[(queue_head + i) % QUEUE_SIZE].type;
+        if (type == GAME_CMD_RESET || type == GAME_CMD_RESIZE || type == GAME_CMD_REMOTE_BOARD)
+            last = i;
+    }
+    if (last == queue_len)
+        return;
+
+    for (size_t i = 0; i < queue_len; ++i) {
+        const struct game_cmd *cmd = &queue[(queue_head + i) % QUEUE_SIZE];
+        if (i >= last || cmd->type != GAME_CMD_CLICK)
+            queue[(queue_head + n++) % QUEUE_SIZE] = *cmd;
+    }
+    queue_len = n;
+    SDL_CondBroadcast (queue_space);
+}
+
+static int
+game_thread (void *arg)
+{
+    (void)arg;
+
+    while (true) {
+        struct game_cmd cmd;
+        bool has_cmd, more = false;
+
+        SDL_LockMutex (queue_mutex);
+        while (queue_len == 0 && !quit_requested && !bsw_revealing (board) && !bsw_busy (board))
+            SDL_CondWait (queue_cond, queue_mutex);
+        if (quit_requested) {
+            SDL_UnlockMutex (queue_mutex);
+            break;
+        }
+
+        if (queue_len != 0 && !cmd_ready (&queue[queue_head]))
+            drop_waiting_clicks ();
+        has_cmd = queue_len != 0 && cmd_ready (&queue[queue_head]);
+        if (has_cmd) {
+            cmd = queue[queue_head];
+            queue_head = (queue_head + 1) % QUEUE_SIZE;
+            more = --queue_len != 0;
+            SDL_CondSignal (queue_space);
+        }
+        SDL_UnlockMutex (queue_mutex);
+
+        if (!has_cmd) {
+            work_frame ();
+            continue;
+        }
+
+        game_exec (&cmd);
+
+        // Coalesce bursts of commands into a single snapshot.
+        if (!more && !bsw_revealing (board) && !bsw_busy (board))
+            publish ();
+    }
+
+    return 0;
+}
+
+// Replay an unfinished game from the journal, which is then rewritten
+// without the moves that didn't change anything.
+static bool
+restore_game (void)
+{
+    struct journal_header hdr;
+    struct journal_move *moves;
+    size_t n_moves;
+
+    if (!journal_restore (&hdr, &moves, &n_moves))
+        return false;
+
+    if (bsw_check_size (hdr.width, hdr.height, hdr.n_mines)
+        || !bsw_resize (board, hdr.width, hdr.height, hdr.n_mines)) {
+        fputs ("Ignoring invalid journal.\n", stderr);
+        free (moves);
+        journal_clear ();
+        return false;
+    }
+
+    board->seed = hdr.seed;
+    first_x = hdr.first_x;
+    first_y = hdr.first_y;
+    bsw_generate (board, first_x, first_y);
+    bsw_work (board, (size_t)-1);
+    // Continue the timer where it was; the journal only has the wall-clock time.
+    board->start_time = hdr.start_time;
+    board->start_ms = monotonic_ms () - (uint64_t)my_max (time (NULL) - board->start_time, 0) * 1000;
+    journal_begin (board, first_x, first_y);
+
+    for (size_t i = 0; i < n_moves && !board->game_over; ++i) {
+        struct tile *t = bsw_tile (board, moves[i].x, journal_move_y (&moves[i]));
+        if (t) {
+            click (t, journal_move_button (&moves[i]));
+            bsw_reveal (board, (size_t)-1);
+        }
+    }
+    free (moves);
+
+    // The game ended before the journal was truncated; its result is already in the history.
+    if (board->game_over) {
+        journal_clear ();
+        return false;
+    }
+
+    printf ("Restored an unfinished game with %zu moves.\n", n_moves);
+    return true;
+}
+
+bool
+game_init (void)
+{
+    if (!restore_game ()) {
+        if (!bsw_resize (board, default_width, default_height, default_n_mines))
+            return false;
+        bsw_work (board, (size_t)-1);
+    }
+
+    queue_mutex = SDL_CreateMutex ();
+    queue_cond = SDL_CreateCond ();
+    queue_space = SDL_CreateCond ();
+    if (!queue_mutex || !queue_cond || !queue_space) {
+        printf ("Failed to create game queue: %s\n", SDL_GetError ());
+        return false;
+    }
+
+    invalidate_views ();
+    publish ();
+
+    thread = SDL_CreateThread (&game_thread, "game", NULL);
+    if (!thread) {
+        printf ("Failed to create game thread: %s\n", SDL_GetError ());
+        return false;
+    }
+    return true;
+}
+
+void
+game_quit (void)
+{
+    if (thread) {
+        SDL_LockMutex (queue_mutex);
+        quit_requested = true;
+        SDL_CondSignal (queue_cond);
+        SDL_CondBroadcast (queue_space);
+        SDL_UnlockMutex (queue_mutex);
+        SDL_WaitThread (thread, NULL);
+        thread = NULL;
+    }
+
+    for (; queue_len != 0; --queue_len, queue_head = (queue_head + 1) % QUEUE_SIZE)
+        free (queue[queue_head].data);
+    for (int i = 0; i < 3; ++i) {
+        free (views[i].tiles);
+        free (views[i].pending);
+    }
+    SDL_DestroyCond (queue_space);
+    SDL_DestroyCond (queue_cond);
+    SDL_DestroyMutex (queue_mutex);
+    bsw_free (board);
+    board = NULL;
+}
+
+static void
+queue_push (const struct game_cmd *cmd, bool wait)
+{
+    SDL_LockMutex (queue_mutex);
+    while (wait && queue_len == QUEUE_SIZE && !quit_requested)
+        SDL_CondWait (queue_space, queue_mutex);
+
+    if (queue_len < QUEUE_SIZE && !quit_requested) {
+        queue[(queue_head + queue_len++) % QUEUE_SIZE] = *cmd;
+        SDL_CondSignal (queue_cond);
+    } else {
+        fputs ("Game thread is busy, dropping command.\n", stderr);
+        free (cmd->data);
+    }
+    SDL_UnlockMutex (queue_mutex);
+}
+
+void
+game_post (const struct game_cmd *cmd)
+{
+    if (spectating) {
+        free (cmd->data);
+    } else if (net_mode == NET_CLIENT) {
+        net_send_cmd (cmd);
+    } else {
+        queue_push (cmd, false);
+    }
+}
+
+void
+game_queue (const struct game_cmd *cmd)
+{
+    queue_push (cmd, true);
+}
+
+void
+game_click (int x, int y, int button)
+{
+    const struct game_cmd cmd = { .type = GAME_CMD_CLICK, .x = x, .y = y, .arg = button };
+    game_post (&cmd);
+}
+
+void
+game_resize (int width, int height, int mines)
+{
+    const struct game_cmd cmd = { .type = GAME_CMD_RESIZE, .x = width, .y = height, .arg = mines };
+    game_post (&cmd);
+}
+
+int
+game_progress (void)
+{
+    return atomic_load (&progress);
+}
+
+const struct board_view *
+game_view (void)
+{
+    atomic_store (&redraw_queued, 0);
+    if (atomic_load (&middle) & VIEW_FRESH)
+        front = atomic_exchange (&middle, front) & ~VIEW_FRESH;
+    return &views[front];
+}
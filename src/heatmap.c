@@ -0,0 +1,741 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Mine probability heatmap.
+ *
+ * Every hidden tile next to a revealed number is part of the frontier. The
+ * frontier is split into components that don't share a number, and every
+ * component is solved on its own by enumerating all mine configurations that
+ * satisfy its numbers, counted by the number of mines they use.
+ *
+ * The components are combined by weighting each choice of mine counts with
+ * the number of ways to place the remaining mines in the interior, i.e. the
+ * hidden tiles without a revealed neighbour.
+ *
+ * A coordinator thread prepares the components, which are then solved by a
+ * pool of threads. Every new board cancels the running computation.
+ */
+#include <SDL2/SDL_mutex.h>
+#include <SDL2/SDL_thread.h>
+#include <SDL2/SDL_cpuinfo.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include "heatmap.h"
+#include "video.h"
+#include "tile.h"
+#include "util.h"
+#include "mem.h"
+#include "bsw.h"
+
+#define HIDDEN (-1)
+
+struct constraint {
+    int count;                              // Mines still needed.
+    int n_vars;
+    int vars[8];                            // Local indices of the hidden neighbours.
+};
+
+struct component {
+    int n_vars, n_cons;
+    int *tiles;                             // Board index of every variable.
+    struct constraint *cons;
+    int (*var_cons)[9];                     // Constraints of every variable, terminated by -1.
+
+    // Results, indexed by the number of mines in this component.
+    double *weights;                        // [n_vars + 1]: Number of configurations.
+    double *tile_weights;                   // [n_vars + 1][n_vars]: Configurations with a mine on this tile.
+    bool solved;
+};
+
+struct search {
+    const struct component *c;
+    double *weights, *tile_weights;
+    signed char *value;
+    int *mines, *left;
+    int n_mines, max_mines;
+    unsigned gen;
+    uint64_t nodes;
+    bool aborted;
+};
+
+static SDL_Thread *threads[HEATMAP_MAX_THREADS];
+static int n_threads;
+static SDL_mutex *mutex;
+static SDL_cond *job_cond, *work_cond, *done_cond;
+static atomic_uint generation;              // Incremented by every change; cancels the computation.
+static atomic_bool shown;
+static bool quit_requested;
+
+// Latest board, protected by `mutex`.
+static signed char *job;                    // Number of every revealed tile, or HIDDEN.
+static int job_width, job_height, job_mines;
+static bool job_valid;
+static unsigned solved_gen;
+
+// Components of the current computation, protected by `mutex`.
+static struct component *comps;
+static int n_comps, n_helping;
+static atomic_int next_comp, n_done;
+static unsigned task_gen;
+static int task_mines;
+
+// Latest result.
+static SDL_mutex *result_mutex;
+static float *result;
+static int result_width, result_height;
+
+static bool
+cancelled (unsigned gen)
+{
+    return atomic_load (&generation) != gen;
+}
+
+static void
+record (struct search *s)
+{
+    const int n = s->c->n_vars;
+
+    s->weights[s->n_mines] += 1.0;
+    for (int v = 0; v < n; ++v) {
+        if (s->value[v])
+            s->tile_weights[s->n_mines * n + v] += 1.0;
+    }
+}
+
+// Assign `value` to `v`; returns false, if a number can't be satisfied anymore.
+static bool
+assign (struct search *s, int v, int value)
+{
+    bool ok = s->n_mines + value <= s->max_mines;
+
+    for (const int *ci = s->c->var_cons[v]; *ci >= 0; ++ci) {
+        const int count = s->c->cons[*ci].count;
+        --s->left[*ci];
+        s->mines[*ci] += value;
+        ok = ok && s->mines[*ci] <= count && s->mines[*ci] + s->left[*ci] >= count;
+    }
+    return ok;
+}
+
+static void
+unassign (struct search *s, int v, int value)
+{
+    for (const int *ci = s->c->var_cons[v]; *ci >= 0; ++ci) {
+        ++s->left[*ci];
+        s->mines[*ci] -= value;
+    }
+}
+
+static void
+search (struct search *s, int v)
+{
+    if ((++s->nodes & 0xfff) == 0 && (cancelled (s->gen) || s->nodes > HEATMAP_MAX_NODES))
+        s->aborted = true;
+    if (s->aborted)
+        return;
+
+    if (v == s->c->n_vars) {
+        record (s);
+        return;
+    }
+
+    for (int value = 0; value <= 1; ++value) {
+        if (assign (s, v, value)) {
+            s->value[v] = value;
+            s->n_mines += value;
+            search (s, v + 1);
+            s->n_mines -= value;
+        }
+        unassign (s, v, value);
+    }
+}
+
+static void
+solve_component (struct component *c, int max_mines, unsigned gen)
+{
+    const int n = c->n_vars;
+    struct search s = {
+        .c = c,
+        .weights = calloc (n + 1, sizeof (double)),
+        .tile_weights = calloc ((size_t)(n + 1) * n, sizeof (double)),
+        .value = calloc (n, 1),
+        .mines = calloc (c->n_cons, sizeof (int)),
+        .left = malloc (c->n_cons * sizeof (int)),
+        .max_mines = max_mines,
+        .gen = gen,
+    };
+
+    if (!s.weights || !s.tile_weights || !s.value || !s.mines || !s.left) {
+        perror ("malloc()");
+        abort ();
+    }
+
+    for (int i = 0; i < c->n_cons; ++i)
+        s.left[i] = c->cons[i].n_vars;
+    search (&s, 0);
+
+    c->weights = s.weights;
+    c->tile_weights = s.tile_weights;
+    c->solved = !s.aborted;
+    free (s.value);
+    free (s.mines);
+    free (s.left);
+}
+
+// Solve components of the current task, until there are none left.
+static void
+help (int max_mines, unsigned gen)
+{
+    int i;
+
+    while ((i = atomic_fetch_add (&next_comp, 1)) < n_comps) {
+        solve_component (&comps[i], max_mines, gen);
+        atomic_fetch_add (&n_done, 1);
+    }
+}
+
+static int
+helper_thread (void *arg)
+{
+    unsigned seen = 0;
+    (void)arg;
+
+    SDL_LockMutex (mutex);
+    while (true) {
+        while (!quit_requested && (!comps || task_gen == seen))
+            SDL_CondWait (work_cond, mutex);
+        if (quit_requested)
+            break;
+
+        const int max_mines = task_mines;
+        seen = task_gen;
+        ++n_helping;
+        SDL_UnlockMutex (mutex);
+
+        help (max_mines, seen);
+
+        SDL_LockMutex (mutex);
+        --n_helping;
+        SDL_CondSignal (done_cond);
+    }
+    SDL_UnlockMutex (mutex);
+    return 0;
+}
+
+static void
+free_components (struct component *c, int n)
+{
+    for (int i = 0; i < n; ++i) {
+        free (c[i].tiles);
+        free (c[i].cons);
+        free (c[i].var_cons);
+        free (c[i].weights);
+        free (c[i].tile_weights);
+    }
+    free (c);
+}
+
+static int
+find (int *parent, int i)
+{
+    while (parent[i] != i)
+        i = parent[i] = parent[parent[i]];
+    return i;
+}
+
+// Split the frontier of `board` into independent components.
+// `var` receives the variable of each tile, or -1 for interior tiles.
+// Returns NULL, if the frontier is too large.
+static struct component *
+build_components (const signed char *board, int width, int height, int *var, int *n_out)
+{
+    const int n_tiles = width * height;
+    int n_vars = 0, n = 0, *parent, *comp_of, *local;
+    struct component *c;
+
+    // Every hidden tile with a revealed neighbour becomes a variable.
+    for (int i = 0; i < n_tiles; ++i) {
+        const int x = i % width, y = i / width;
+        var[i] = -1;
+        if (board[i] != HIDDEN)
+            continue;
+        for (int j = 0; j < 9 && var[i] < 0; ++j) {
+            const int nx = x + j % 3 - 1, ny = y + j / 3 - 1;
+            if (nx >= 0 && nx < width && ny >= 0 && ny < height && board[ny * width + nx] != HIDDEN)
+                var[i] = n_vars++;
+        }
+    }
+    if (n_vars > HEATMAP_MAX_VARS)
+        return NULL;
+
+    parent = malloc (n_vars * sizeof (int) + 1);
+    comp_of = malloc (n_vars * sizeof (int) + 1);
+    local = malloc (n_vars * sizeof (int) + 1);
+    if (!parent || !comp_of || !local) {
+        perror ("malloc()");
+        abort ();
+    }
+    for (int i = 0; i < n_vars; ++i)
+        parent[i] = i;
+
+    // Variables that share a number belong to the same component.
+    for (int i = 0; i < n_tiles; ++i) {
+        int first = -1;
+        if (board[i] == HIDDEN)
+            continue;
+        for (int j = 0; j < 9; ++j) {
+            const int nx = i % width + j % 3 - 1, ny = i / width + j / 3 - 1;
+            if (nx < 0 || nx >= width || ny < 0 || ny >= height || var[ny * width + nx] < 0)
+                continue;
+            if (first < 0) {
+                first = find (parent, var[ny * width + nx]);
+            } else {
+                parent[find (parent, var[ny * width + nx])] = first;
+            }
+        }
+    }
+
+    for (int i = 0; i < n_vars; ++i)
+        comp_of[i] = -1;
+    for (int i = 0; i < n_vars; ++i) {
+        const int root = find (parent, i);
+        if (comp_of[root] < 0)
+            comp_of[root] = n++;
+        comp_of[i] = comp_of[root];
+    }
+
+    c = calloc (n + 1, sizeof (struct component));
+    if (!c) {
+        perror ("calloc()");
+        abort ();
+    }
+
+    // Number the variables of each component in board order, which keeps
+    // the variables of a number close together and prunes the search early.
+    for (int i = 0; i < n_tiles; ++i) {
+        if (var[i] < 0)
+            continue;
+        struct component *cc = &c[comp_of[var[i]]];
+        cc->tiles = realloc (cc->tiles, (cc->n_vars + 1) * sizeof (int));
+        if (!cc->tiles) {
+            perror ("realloc()");
+            abort ();
+        }
+        local[var[i]] = cc->n_vars;
+        cc->tiles[cc->n_vars++] = i;
+    }
+    for (int i = 0; i < n; ++i) {
+        c[i].var_cons = malloc (c[i].n_vars * sizeof *c[i].var_cons);
+        if (!c[i].var_cons) {
+            perror ("malloc()");
+            abort ();
+        }
+        for (int v = 0; v < c[i].n_vars; ++v)
+            c[i].var_cons[v][0] = -1;
+    }
+
+    for (int i = 0; i < n_tiles; ++i) {
+        struct constraint con = { .count = board[i] };
+        struct component *cc = NULL;
+
+        if (board[i] == HIDDEN)
+            continue;
+        for (int j = 0; j < 9; ++j) {
+            const int nx = i % width + j % 3 - 1, ny = i / width + j / 3 - 1;
+            int v;
+            if (nx < 0 || nx >= width || ny < 0 || ny >= height || (v = var[ny * width + nx]) < 0)
+                continue;
+            cc = &c[comp_of[v]];
+            con.vars[con.n_vars++] = local[v];
+        }
+        if (!cc)
+            continue;
+
+        cc->cons = realloc (cc->cons, (cc->n_cons + 1) * sizeof (struct constraint));
+        if (!cc->cons) {
+            perror ("realloc()");
+            abort ();
+        }
+        for (int j = 0; j < con.n_vars; ++j) {
+            int *vc = cc->var_cons[con.vars[j]];
+            while (*vc >= 0)
+                ++vc;
+            vc[0] = cc->n_cons;
+            vc[1] = -1;
+        }
+        cc->cons[cc->n_cons++] = con;
+    }
+
+    free (parent);
+    free (comp_of);
+    free (local);
+    *n_out = n;
+    return c;
+}
+
+// Convolve the mine count distributions `a` and `b` into `out`, up to `max` mines.
+static void
+convolve (const double *a, int na, const double *b, int nb, double *out, int max)
+{
+    for (int k = 0; k <= max; ++k)
+        out[k] = 0.0;
+    for (int i = 0; i <= my_min (na, max); ++i) {
+        if (a[i] == 0.0)
+            continue;
+        for (int j = 0; j <= my_min (nb, max - i); ++j)
+            out[i + j] += a[i] * b[j];
+    }
+}
+
+// Combine the solved components into the probability of every tile.
+static bool
+combine (struct component *c, int n, const signed char *board, const int *var, int n_tiles, int mines, float *prob, unsigned gen)
+{
+    int U = 0, F = 0, M;
+    double *prefix, *suffix, *binom, *others, z = 0.0, interior = 0.0, max_log = -INFINITY;
+
+    for (int i = 0; i < n_tiles; ++i)
+        U += board[i] == HIDDEN && var[i] < 0;
+    for (int i = 0; i < n; ++i)
+        F += c[i].n_vars;
+
+    // At most F mines can be on the frontier.
+    M = my_min (mines, F);
+
+    // Scale each component, so the products don't overflow.
+    for (int i = 0; i < n; ++i) {
+        double scale = 0.0;
+        for (int k = 0; k <= c[i].n_vars; ++k)
+            scale = my_max (scale, c[i].weights[k]);
+        if (scale == 0.0)
+            return false;
+        for (int k = 0; k <= c[i].n_vars; ++k)
+            c[i].weights[k] /= scale;
+        for (int k = 0; k < (c[i].n_vars + 1) * c[i].n_vars; ++k)
+            c[i].tile_weights[k] /= scale;
+    }
+
+    // prefix[i] is the distribution of components [0, i), suffix[i] of [i, n).
+    const int len = M + 1;
+    prefix = calloc ((size_t)(n + 1) * len, sizeof (double));
+    suffix = calloc ((size_t)(n + 1) * len, sizeof (double));
+    binom = malloc (len * sizeof (double));
+    others = malloc (len * sizeof (double));
+    if (!prefix || !suffix || !binom || !others) {
+        perror ("malloc()");
+        abort ();
+    }
+    prefix[0] = suffix[n * len] = 1.0;
+    for (int i = 0; i < n; ++i)
+        convolve (&prefix[i * len], M, c[i].weights, c[i].n_vars, &prefix[(i + 1) * len], M);
+    for (int i = n; i > 0; --i)
+        convolve (&suffix[i * len], M, c[i - 1].weights, c[i - 1].n_vars, &suffix[(i - 1) * len], M);
+
+    // Ways to place the remaining mines in the interior, relative to the largest one.
+    for (int K = 0; K <= M; ++K) {
+        const int r = mines - K;
+        binom[K] = r >= 0 && r <= U ? lgamma (U + 1) - lgamma (r + 1) - lgamma (U - r + 1) : -INFINITY;
+        max_log = my_max (max_log, binom[K]);
+    }
+    for (int K = 0; K <= M; ++K)
+        binom[K] = exp (binom[K] - max_log);
+
+    for (int K = 0; K <= M; ++K) {
+        z += prefix[n * len + K] * binom[K];
+        if (U > 0)
+            interior += prefix[n * len + K] * binom[K] * (mines - K) / U;
+    }
+    for (int i = 0; i < n_tiles; ++i)
+        prob[i] = board[i] == HIDDEN ? interior / z : -1.0f;
+
+    for (int i = 0; i < n && z > 0.0 && !cancelled (gen); ++i) {
+        const int nv = c[i].n_vars;
+        convolve (&prefix[i * len], M, &suffix[(i + 1) * len], M, others, M);
+
+        for (int k = 0; k <= my_min (nv, M); ++k) {
+            double w = 0.0;
+            for (int K = 0; K + k <= M; ++K)
+                w += others[K] * binom[K + k];
+            w /= z;
+            for (int v = 0; v < nv; ++v)
+                c[i].tile_weights[k * nv + v] *= w;
+        }
+        for (int v = 0; v < nv; ++v) {
+            double p = 0.0;
+            for (int k = 0; k <= my_min (nv, M); ++k)
+                p += c[i].tile_weights[k * nv + v];
+            prob[c[i].tiles[v]] = p;
+        }
+    }
+
+    free (prefix);
+    free (suffix);
+    free (binom);
+    free (others);
+    return z > 0.0 && !cancelled (gen);
+}
+
+// Must be called with `result_mutex` locked.
+static void
+free_result (void)
+{
+    if (result)
+        mem_account (MEM_HEATMAP, -(ptrdiff_t)((size_t)result_width * result_height * sizeof (float)));
+    free (result);
+    result = NULL;
+}
+
+static void
+push_redraw (void)
+{
+    SDL_Event e;
+    SDL_zero (e);
+    e.user.type = SDL_USEREVENT;
+    e.user.code = EV_REDRAW;
+    SDL_PushEvent (&e);
+}
+
+static void
+solve (const signed char *board, int width, int height, int mines, unsigned gen)
+{
+    const int n_tiles = width * height;
+    int *var = malloc (n_tiles * sizeof (int));
+    float *prob = malloc (n_tiles * sizeof (float));
+    struct component *c;
+    bool ok, published;
+    int n;
+
+    if (!var || !prob) {
+        perror ("malloc()");
+        abort ();
+    }
+    mem_account (MEM_HEATMAP, n_tiles * (sizeof (int) + sizeof (float)));
+
+    c = build_components (board, width, height, var, &n);
+    ok = c != NULL;
+
+    // Hand the components to the helpers, and solve them together.
+    SDL_LockMutex (mutex);
+    comps = c;
+    n_comps = ok ? n : 0;
+    task_gen = gen;
+    task_mines = mines;
+    atomic_store (&next_comp, 0);
+    atomic_store (&n_done, 0);
+    SDL_CondBroadcast (work_cond);
+    SDL_UnlockMutex (mutex);
+
+    help (mines, gen);
+
+    SDL_LockMutex (mutex);
+    while (atomic_load (&n_done) < n_comps || n_helping > 0)
+        SDL_CondWait (done_cond, mutex);
+    comps = NULL;
+    SDL_UnlockMutex (mutex);
+
+    for (int i = 0; ok && i < n; ++i)
+        ok = c[i].solved;
+    ok = ok && combine (c, n, board, var, n_tiles, mines, prob, gen);
+
+    // Boards that are too hard to solve get no heatmap.
+    published = ok && !cancelled (gen);
+    if (!cancelled (gen)) {
+        SDL_LockMutex (result_mutex);
+        free_result ();
+        result = ok ? prob : NULL;
+        result_width = width;
+        result_height = height;
+        SDL_UnlockMutex (result_mutex);
+        push_redraw ();
+    }
+    if (!published) {
+        mem_account (MEM_HEATMAP, -(ptrdiff_t)(n_tiles * sizeof (float)));
+        free (prob);
+    }
+    if (c)
+        free_components (c, n);
+    mem_account (MEM_HEATMAP, -(ptrdiff_t)(n_tiles * sizeof (int)));
+    free (var);
+}
+
+static int
+heatmap_thread (void *arg)
+{
+    signed char *board = NULL;
+    size_t board_size = 0;
+    (void)arg;
+
+    SDL_LockMutex (mutex);
+    while (true) {
+        while (!quit_requested && (!job_valid || solved_gen == atomic_load (&generation)))
+            SDL_CondWait (job_cond, mutex);
+        if (quit_requested)
+            break;
+
+        const unsigned gen = atomic_load (&generation);
+        const int width = job_width, height = job_height, mines = job_mines;
+
+        // Take the board, so the game thread can continue.
+        mem_account (MEM_HEATMAP, -(ptrdiff_t)board_size);
+        free (board);
+        board = job;
+        board_size = (size_t)width * height;
+        job = NULL;
+        job_valid = false;
+        solved_gen = gen;
+        SDL_UnlockMutex (mutex);
+
+        solve (board, width, height, mines, gen);
+
+        SDL_LockMutex (mutex);
+    }
+    SDL_UnlockMutex (mutex);
+    mem_account (MEM_HEATMAP, -(ptrdiff_t)board_size);
+    free (board);
+    return 0;
+}
+
+bool
+heatmap_init (void)
+{
+    mutex = SDL_CreateMutex ();
+    result_mutex = SDL_CreateMutex ();
+    job_cond = SDL_CreateCond ();
+    work_cond = SDL_CreateCond ();
+    done_cond = SDL_CreateCond ();
+    if (!mutex || !result_mutex || !job_cond || !work_cond || !done_cond) {
+        printf ("Failed to create heatmap: %s\n", SDL_GetError ());
+        return false;
+    }
+
+    n_threads = my_clamp (SDL_GetCPUCount (), 1, HEATMAP_MAX_THREADS);
+    for (int i = 0; i < n_threads; ++i) {
+        threads[i] = SDL_CreateThread (i == 0 ? &heatmap_thread : &helper_thread, "heatmap", NULL);
+        if (!threads[i]) {
+            printf ("Failed to create heatmap thread: %s\n", SDL_GetError ());
+            n_threads = i;
+            return false;
+        }
+    }
+    return true;
+}
+
+void
+heatmap_quit (void)
+{
+    SDL_LockMutex (mutex);
+    quit_requested = true;
+    atomic_fetch_add (&generation, 1);
+    SDL_CondBroadcast (job_cond);
+    SDL_CondBroadcast (work_cond);
+    SDL_UnlockMutex (mutex);
+
+    for (int i = 0; i < n_threads; ++i)
+        SDL_WaitThread (threads[i], NULL);
+    n_threads = 0;
+
+    if (job)
+        mem_account (MEM_HEATMAP, -(ptrdiff_t)((size_t)job_width * job_height));
+    free (job);
+    free_result ();
+    job = NULL;
+    SDL_DestroyCond (done_cond);
+    SDL_DestroyCond (work_cond);
+    SDL_DestroyCond (job_cond);
+    SDL_DestroyMutex (result_mutex);
+    SDL_DestroyMutex (mutex);
+}
+
+void
+heatmap_update (const struct board_view *v)
+{
+    const size_t n_tiles = (size_t)v->width * v->height;
+
+    if (!atomic_load (&shown))
+        return;
+
+    SDL_LockMutex (mutex);
+    atomic_fetch_add (&generation, 1);
+
+    // There is nothing to solve before the first click or after the game,
+    // and boards with more than INT_MAX tiles are not supported.
+    job_valid = v->generated && !v->game_over && n_tiles <= INT_MAX;
+    if (!job_valid) {
+        SDL_LockMutex (result_mutex);
+        free_result ();
+        SDL_UnlockMutex (result_mutex);
+    } else {
+        if (!job || (size_t)job_width * job_height != n_tiles) {
+            if (job)
+                mem_account (MEM_HEATMAP, -(ptrdiff_t)((size_t)job_width * job_height));
+            free (job);
+            job = malloc (n_tiles);
+            if (!job) {
+                perror ("malloc()");
+                abort ();
+            }
+            mem_account (MEM_HEATMAP, n_tiles);
+        }
+        for (size_t i = 0; i < n_tiles; ++i) {
+            const unsigned char t = v->tiles[i];
+            job[i] = tile_view_status (t) == TILE_CLICKED ? (signed char)tile_view_count (t) : HIDDEN;
+        }
+        job_width = v->width;
+        job_height = v->height;
+        job_mines = v->n_bombs;
+        SDL_CondSignal (job_cond);
+    }
+    SDL_UnlockMutex (mutex);
+}
+
+void
+heatmap_toggle (void)
+{
+    const bool show = !atomic_load (&shown);
+
+    atomic_store (&shown, show);
+    if (show) {
+        heatmap_update (game_view ());
+    } else {
+        atomic_fetch_add (&generation, 1);
+    }
+}
+
+bool
+heatmap_shown (void)
+{
+    return atomic_load (&shown);
+}
+
+const float *
+heatmap_lock (int width, int height)
+{
+    SDL_LockMutex (result_mutex);
+    return result && result_width == width && result_height == height ? result : NULL;
+}
+
+void
+heatmap_unlock (void)
+{
+    SDL_UnlockMutex (result_mutex);
+}
@@ -0,0 +1,290 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Every finished game is appended to `history.bin` as a fixed-size record.
+ * The statistics are kept in `history.idx`, which is updated on every append
+ * and records how many games it covers. It is only rebuilt from the log, if
+ * it doesn't match the log (e.g. after a crash) or the presets changed.
+ *
+ * The presets always have an entry in the index, and the other board
+ * configurations get one in the order they are first played, as long as
+ * there is room.
+ *
+ * Both files use the native byte order.
+ */
+#include <SDL2/SDL_mutex.h>
+#include <sys/types.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include "history.h"
+#include "util.h"
+#include "bsw.h"
+
+#define HISTORY_VERSION 1
+
+struct history_header {
+    char magic[4];
+    uint32_t version;
+};
+
+struct history_entry {
+    uint32_t width, height;
+    uint64_t n_mines;
+    struct history_stats stats;
+};
+
+struct history_index {
+    struct history_header hdr;
+    uint64_t n_records;                     // Number of records in the log covered by this index.
+    uint32_t n_entries, reserved;
+    struct history_stats total;
+    struct history_entry entries[HISTORY_MAX_ENTRIES];
+};
+
+static const struct history_header log_header = { { 'B', 'S', 'W', 'H' }, HISTORY_VERSION };
+static const struct history_header index_header = { { 'B', 'S', 'W', 'I' }, HISTORY_VERSION };
+
+static struct history_index hist;
+static SDL_mutex *mutex;
+static char *log_path, *index_path;
+
+static void
+stats_update (struct history_stats *s, const struct history_record *r)
+{
+    ++s->n_games;
+    if (r->flags & HISTORY_WON) {
+        ++s->n_wins;
+        s->total_ms += r->time_ms;
+        if (s->best_ms == 0 || r->time_ms < s->best_ms)
+            s->best_ms = r->time_ms;
+    }
+}
+
+static struct history_entry *
+find_entry (uint32_t width, uint32_t height, uint64_t n_mines)
+{
+    for (uint32_t i = 0; i < hist.n_entries; ++i) {
+        struct history_entry *e = &hist.entries[i];
+        if (e->width == width && e->height == height && e->n_mines == n_mines)
+            return e;
+    }
+    return NULL;
+}
+
+static struct history_entry *
+new_entry (uint32_t width, uint32_t height, uint64_t n_mines)
+{
+    struct history_entry *e = &hist.entries[hist.n_entries++];
+
+    e->width = width;
+    e->height = height;
+    e->n_mines = n_mines;
+    return e;
+}
+
+static void
+index_update (const struct history_record *r)
+{
+    struct history_entry *e = find_entry (r->width, r->height, r->n_mines);
+
+    // Configurations beyond HISTORY_MAX_ENTRIES only count towards the total.
+    if (!e && hist.n_entries < HISTORY_MAX_ENTRIES)
+        e = new_entry (r->width, r->height, r->n_mines);
+
+    stats_update (&hist.total, r);
+    if (e)
+        stats_update (&e->stats, r);
+    ++hist.n_records;
+}
+
+static void
+index_reset (void)
+{
+    memset (&hist, 0, sizeof hist);
+    hist.hdr = index_header;
+    for (size_t i = 0; i < arraylen (default_presets); ++i) {
+        const int *p = default_presets[i];
+        if (!find_entry (p[0], p[1], p[2]))
+            new_entry (p[0], p[1], p[2]);
+    }
+}
+
+// Whether every preset has an entry in the index.
+static bool
+index_has_presets (void)
+{
+    for (size_t i = 0; i < arraylen (default_presets); ++i) {
+        const int *p = default_presets[i];
+        if (!find_entry (p[0], p[1], p[2]))
+            return false;
+    }
+    return true;
+}
+
+static void
+index_save (void)
+{
+    const size_t len = strlen (index_path) + 5;
+    char *tmp = malloc (len);
+    FILE *file;
+
+    // Write a new file and rename it, so the index is never half-written.
+    snprintf (tmp, len, "%s.tmp", index_path);
+    file = fopen (tmp, "wb");
+    if (!file) {
+        fprintf (stderr, "Failed to open '%s': %s\n", tmp, strerror (errno));
+        free (tmp);
+        return;
+    }
+    if (fwrite (&hist, sizeof hist, 1, file) != 1 || fclose (file) != 0) {
+        fprintf (stderr, "Failed to write '%s': %s\n", tmp, strerror (errno));
+    } else if (rename (tmp, index_path) != 0) {
+        fprintf (stderr, "Failed to rename '%s': %s\n", tmp, strerror (errno));
+    }
+    free (tmp);
+}
+
+static void
+index_rebuild (FILE *log, uint64_t n_records)
+{
+    struct history_record buffer[256];
+
+    index_reset ();
+    fseek (log, sizeof (struct history_header), SEEK_SET);
+    while (n_records > 0) {
+        const size_t n = fread (buffer, sizeof *buffer, my_min (n_records, arraylen (buffer)), log);
+        if (n == 0)
+            break;
+        for (size_t i = 0; i < n; ++i)
+            index_update (&buffer[i]);
+        n_records -= n;
+    }
+}
+
+void
+history_load (void)
+{
+    struct history_header hdr;
+    FILE *log, *file;
+    uint64_t n_records;
+    long size;
+    bool valid;
+
+    mutex = SDL_CreateMutex ();
+    log_path = config_path ("history.bin");
+    index_path = config_path ("history.idx");
+    index_reset ();
+    if (!log_path || !index_path)
+        return;
+
+    log = fopen (log_path, "rb");
+    if (!log)
+        return;
+
+    if (fread (&hdr, sizeof hdr, 1, log) != 1 || memcmp (&hdr, &log_header, sizeof hdr) != 0) {
+        fprintf (stderr, "Invalid game history '%s', ignoring it.\n", log_path);
+        fclose (log);
+        free (log_path);
+        log_path = NULL;
+        return;
+    }
+
+    // Drop a record that was only partially written.
+    fseek (log, 0, SEEK_END);
+    size = ftell (log);
+    n_records = (size - sizeof hdr) / sizeof (struct history_record);
+    if (size != (long)(sizeof hdr + n_records * sizeof (struct history_record))) {
+        fprintf (stderr, "Truncating incomplete record in '%s'.\n", log_path);
+        if (truncate (log_path, sizeof hdr + n_records * sizeof (struct history_record)) != 0)
+            perror ("truncate()");
+    }
+
+    // Use the index, if it matches the log.
+    file = fopen (index_path, "rb");
+    valid = file != NULL
+        && fread (&hist, sizeof hist, 1, file) == 1
+        && memcmp (&hist.hdr, &index_header, sizeof hist.hdr) == 0
+        && hist.n_records == n_records
+        && hist.n_entries <= HISTORY_MAX_ENTRIES
+        && index_has_presets ();
+    if (file)
+        fclose (file);
+
+    if (!valid) {
+        fprintf (stderr, "Rebuilding '%s'.\n", index_path);
+        index_rebuild (log, n_records);
+        index_save ();
+    }
+    fclose (log);
+}
+
+void
+history_add (const struct history_record *r)
+{
+    FILE *log;
+
+    if (!log_path || !index_path)
+        return;
+
+    SDL_LockMutex (mutex);
+
+    char *dup = strdup (log_path);
+    dirname (dup);
+    mkdir_p (dup);
+    free (dup);
+
+    log = fopen (log_path, "ab");
+    if (!log) {
+        fprintf (stderr, "Failed to open '%s': %s\n", log_path, strerror (errno));
+        SDL_UnlockMutex (mutex);
+        return;
+    }
+
+    fseek (log, 0, SEEK_END);
+    if (ftell (log) == 0)
+        fwrite (&log_header, sizeof log_header, 1, log);
+    if (fwrite (r, sizeof *r, 1, log) != 1 || fclose (log) != 0) {
+        fprintf (stderr, "Failed to write '%s': %s\n", log_path, strerror (errno));
+        SDL_UnlockMutex (mutex);
+        return;
+    }
+
+    index_update (r);
+    index_save ();
+    SDL_UnlockMutex (mutex);
+}
+
+bool
+history_get (uint32_t width, uint32_t height, uint64_t n_mines, struct history_stats *stats)
+{
+    const struct history_entry *e;
+
+    SDL_LockMutex (mutex);
+    e = find_entry (width, height, n_mines);
+    if (e && e->stats.n_games == 0)
+        e = NULL;
+    if (e)
+        *stats = e->stats;
+    SDL_UnlockMutex (mutex);
+
+    return e != NULL;
+}
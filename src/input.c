@@ -15,9 +15,14 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <stdbool.h>
+#include <stdio.h>
+#include <math.h>
+#include "heatmap.h"
+#include "layout.h"
 #include "dialog.h"
+#include "export.h"
 #include "video.h"
-#include "tile.h"
+#include "game.h"
 #include "menu.h"
 #include "util.h"
 #include "bsw.h"
@@ -27,7 +32,10 @@
 #define HAPTIC_INTENSITY 1.0f
 #define HAPTIC_DURATION 100
 
-#define EV_LONG_CLICK 1
+#define FLING_MIN_SPEED 50.0f               // Pixels per second at which a fling stops.
+#define FLING_FRICTION  4.0f                // A fling slows down by e^-FRICTION per second.
+#define FLING_MAX_REST  0.05f               // Seconds a drag may rest before the release and still fling.
+#define ZOOM_RATE       15.0f               // Speed at which t_size approaches its target.
 
 #define stop_timer(tid)         \
 do {                            \
@@ -37,6 +45,19 @@ do {                            \
     }                           \
 } while (0)
 
+// Panning and zooming only move the view, animate() draws it once per
+// display frame. Released drags keep gliding and zooming eases towards
+// the target size, while nothing moves the main loop sleeps in SDL_WaitEvent.
+static struct {
+    Uint64 last_frame;                      // Performance counter of the last frame.
+    Uint64 last_motion;                     // ... of the last drag motion, 0 before the first.
+    bool dirty;                             // The view moved since the last frame.
+    bool dragging;
+    float vx, vy;                           // Pan velocity in pixels per second.
+    float zoom_target;                      // Tile size to zoom to, 0 if not zooming.
+    SDL_Point zoom_focus;
+} anim;
+
 static bool
 click (SDL_Point p, int button)
 {
@@ -46,9 +67,8 @@ click (SDL_Point p, int button)
     if (menu.shown)
         return menu_click (p, button);
 
-    if (game_over) {
+    if (game_view ()->game_over) {
         reset_game ();
-        render ();
         return true;
     }
 
@@ -56,29 +76,19 @@ click (SDL_Point p, int button)
     const int tx = (p.x - t_offX * ts) / ts;
     const int ty = (p.y - t_offY * ts) / ts;
 
-    if (!generated)
-        generate_tiles (tx, ty);
-
-    struct tile *t = get_tile (tx, ty);
-
-    if (t) {
-        tile_click (t, button);
-        return true;
-    }
-
+    game_click (tx, ty, button);
     return true;
 }
 
+// Set the tile size, keeping the tile under `p` in place.
 static void
-zoom (SDL_Point p, float factor)
+set_size (SDL_Point p, float size)
 {
     int ts = t_size;
     const float preX = (float)(p.x - t_offX * ts) / ts;
     const float preY = (float)(p.y - t_offY * ts) / ts;
 
-    // Zoom in/out with the scroll wheel.
-    const float mx = my_min (w_width / 5, w_height / 5);
-    t_size = my_clamp (t_size * factor, 10.0f, mx);
+    t_size = size;
     ts = (int)t_size;
 
     const float afterX = (float)(p.x - t_offX * ts) / ts;
@@ -87,25 +97,148 @@ zoom (SDL_Point p, float factor)
     // Adjust the position of the tiles to have the same relative position.
     t_offX += afterX - preX;
     t_offY += afterY - preY;
+    anim.dirty = true;
+}
 
-    render ();
+static void
+zoom (SDL_Point p, float factor)
+{
+    const float target = anim.zoom_target > 0.0f ? anim.zoom_target : t_size;
+
+    // Zoom in/out with the scroll wheel; animate() moves towards the target.
+    const float mx = my_min (w_width / 5, w_height / 5);
+    anim.zoom_target = my_clamp (target * factor, 10.0f, mx);
+    anim.zoom_focus = p;
 }
 
+// Move the board by `dx`, `dy` pixels, a limit stops a fling along its axis.
 static void
-pan (SDL_Point delta)
+pan (float dx, float dy)
 {
-    if (menu.shown || dialog_is_open)
+    if (menu.shown || dialog_is_open) {
+        anim.vx = anim.vy = 0.0f;
         return;
+    }
 
+    const struct board_view *v = game_view ();
     const int ts = t_size;
-    t_offX += (float)delta.x / ts;
-    t_offY += (float)delta.y / ts;
+    const float x = t_offX + dx / ts;
+    const float y = t_offY + dy / ts;
 
     // Limit the amount of panning.
-    t_offX = my_clamp (t_offX, -t_width + 1, ((float)w_width / ts) - 1);
-    t_offY = my_clamp (t_offY, -t_height + 1, ((float)w_height / ts) - 1);
+    t_offX = my_clamp (x, -v->width + 1, ((float)w_width / ts) - 1);
+    t_offY = my_clamp (y, -v->height + 1, ((float)w_height / ts) - 1);
+    if (t_offX != x)
+        anim.vx = 0.0f;
+    if (t_offY != y)
+        anim.vy = 0.0f;
+    anim.dirty = true;
+}
+
+// A new drag catches the board, stopping a fling.
+static void
+drag_begin (void)
+{
+    anim.dragging = true;
+    anim.vx = anim.vy = 0.0f;
+    anim.last_motion = 0;
+}
+
+static void
+drag_move (float dx, float dy)
+{
+    const Uint64 now = SDL_GetPerformanceCounter ();
+    const float dt = (float)(now - anim.last_motion) / SDL_GetPerformanceFrequency ();
+
+    // Smooth the velocity over the last few events, the first one has none.
+    if (anim.last_motion && dt > 0.0f && dt < FLING_MAX_REST) {
+        anim.vx = anim.vx * 0.5f + dx / dt * 0.5f;
+        anim.vy = anim.vy * 0.5f + dy / dt * 0.5f;
+    } else {
+        anim.vx = anim.vy = 0.0f;
+    }
+    anim.dragging = true;
+    anim.last_motion = now;
+    pan (dx, dy);
+}
+
+// Let the board glide on, unless it rested before the release.
+static void
+drag_end (void)
+{
+    const float rest = (float)(SDL_GetPerformanceCounter () - anim.last_motion) / SDL_GetPerformanceFrequency ();
+
+    if (!anim.dragging)
+        return;
+    anim.dragging = false;
+    if (rest >= FLING_MAX_REST || hypotf (anim.vx, anim.vy) < FLING_MIN_SPEED)
+        anim.vx = anim.vy = 0.0f;
+}
+
+static bool
+animating (void)
+{
+    return anim.dirty || anim.zoom_target > 0.0f || (!anim.dragging && (anim.vx != 0.0f || anim.vy != 0.0f));
+}
+
+static Uint64
+frame_interval (void)
+{
+    const int display = SDL_GetWindowDisplayIndex (window);
+    SDL_DisplayMode mode;
+    int hz = 60;
 
-    render ();
+    if (display >= 0 && SDL_GetCurrentDisplayMode (display, &mode) == 0 && mode.refresh_rate > 0)
+        hz = mode.refresh_rate;
+    return SDL_GetPerformanceFrequency () / hz;
+}
+
+int
+animate (void)
+{
+    if (!animating ())
+        return -1;
+
+    const Uint64 freq = SDL_GetPerformanceFrequency ();
+    const Uint64 interval = frame_interval ();
+    Uint64 now = SDL_GetPerformanceCounter ();
+
+    if (now - anim.last_frame >= interval) {
+        // Long pauses between animations must not make the first frame jump.
+        const float dt = my_min ((float)(now - anim.last_frame) / freq, 0.05f);
+
+        anim.last_frame = now;
+
+        if (!anim.dragging && (anim.vx != 0.0f || anim.vy != 0.0f)) {
+            const float decay = expf (-FLING_FRICTION * dt);
+
+            pan (anim.vx * dt, anim.vy * dt);
+            anim.vx *= decay;
+            anim.vy *= decay;
+            if (hypotf (anim.vx, anim.vy) < FLING_MIN_SPEED)
+                anim.vx = anim.vy = 0.0f;
+        }
+
+        if (anim.zoom_target > 0.0f) {
+            float size = t_size + (anim.zoom_target - t_size) * (1.0f - expf (-ZOOM_RATE * dt));
+
+            if (fabsf (anim.zoom_target - size) < 0.05f) {
+                size = anim.zoom_target;
+                anim.zoom_target = 0.0f;
+            }
+            set_size (anim.zoom_focus, size);
+        }
+
+        if (anim.dirty) {
+            anim.dirty = false;
+            render ();
+        }
+        if (!animating ())
+            return -1;
+        now = SDL_GetPerformanceCounter ();
+    }
+
+    return now - anim.last_frame >= interval ? 0 : (anim.last_frame + interval - now) * 1000 / freq;
 }
 
 static Uint32
@@ -123,6 +256,19 @@ cb_touch (Uint32 interval, void *arg)
     return 0;
 }
 
+// Copy the code of the current board, so it can be shared with --board.
+static void
+copy_board_code (void)
+{
+    const struct board_view *v = game_view ();
+    char code[LAYOUT_CODE_MAX];
+
+    layout_code (code, v->width, v->height, v->n_bombs, v->seed);
+    printf ("Board code: %s\n", code);
+    if (SDL_SetClipboardText (code) != 0)
+        printf ("Failed to copy the board code: %s\n", SDL_GetError ());
+}
+
 bool
 handle_event (const SDL_Event *e)
 {
@@ -139,6 +285,8 @@ handle_event (const SDL_Event *e)
             shift_pressed = true;
             break;
         case SDLK_SPACE:
+            if (!space_pressed)
+                drag_begin ();
             space_pressed = true;
             break;
         }
@@ -153,7 +301,6 @@ handle_event (const SDL_Event *e)
             if (e->key.keysym.mod & KMOD_CTRL)
                 relaunch ();
             reset_game ();
-            render ();
             break;
         case SDLK_ESCAPE:
             if (dialog_is_open) {
@@ -166,6 +313,16 @@ handle_event (const SDL_Event *e)
             menu.shown = !menu.shown;
             render ();
             break;
+        case SDLK_p:
+            heatmap_toggle ();
+            render ();
+            break;
+        case SDLK_c:
+            copy_board_code ();
+            break;
+        case SDLK_e:
+            export_start (game_view ());
+            break;
         case SDLK_q:
             return false;
         case SDLK_LSHIFT:
@@ -173,14 +330,23 @@ handle_event (const SDL_Event *e)
             break;
         case SDLK_SPACE:
             space_pressed = false;
+            drag_end ();
             break;
         }
         break;
 
     // Mouse-related
+    case SDL_MOUSEBUTTONDOWN:
+        if (e->button.which != SDL_TOUCH_MOUSEID && e->button.button == SDL_BUTTON_MIDDLE)
+            drag_begin ();
+        break;
     case SDL_MOUSEBUTTONUP: {
-        if (e->button.which == SDL_TOUCH_MOUSEID || e->button.button == SDL_BUTTON_MIDDLE)
+        if (e->button.which == SDL_TOUCH_MOUSEID)
             break;
+        if (e->button.button == SDL_BUTTON_MIDDLE) {
+            drag_end ();
+            break;
+        }
         const SDL_Point p = { e->button.x, e->button.y };
         return click (p, e->button.button);
     }
@@ -191,10 +357,8 @@ handle_event (const SDL_Event *e)
         mouseY = e->motion.y;
 
         // Panning
-        if (space_pressed || e->motion.state == SDL_BUTTON_MIDDLE) {
-            const SDL_Point delta = { e->motion.xrel, e->motion.yrel };
-            pan (delta);
-        }
+        if (space_pressed || e->motion.state == SDL_BUTTON_MIDDLE)
+            drag_move (e->motion.xrel, e->motion.yrel);
         break;
     case SDL_MOUSEWHEEL: {
         if (e->button.which == SDL_TOUCH_MOUSEID)
@@ -207,6 +371,7 @@ handle_event (const SDL_Event *e)
     // Touchscreen-related
     case SDL_FINGERDOWN:
         ++num_fingers;
+        drag_begin ();
         if (touch_timerID) {
             stop_timer (touch_timerID);
         } else if (num_fingers == 1) {
@@ -221,6 +386,8 @@ handle_event (const SDL_Event *e)
             const SDL_Point p = { e->tfinger.x * w_width, e->tfinger.y * w_height };
             click (p, SDL_BUTTON_LEFT);
         }
+        if (num_fingers == 0)
+            drag_end ();
         stop_timer (touch_timerID);
         break;
     case SDL_FINGERMOTION:
@@ -232,8 +399,7 @@ handle_event (const SDL_Event *e)
                 break;
 
             stop_timer (touch_timerID);
-            const SDL_Point p = { dx * w_width, dy * w_height };
-            pan (p);
+            drag_move (dx * w_width, dy * w_height);
         }
         break;
     case SDL_MULTIGESTURE:
@@ -253,6 +419,17 @@ handle_event (const SDL_Event *e)
                 SDL_HapticRumblePlay (haptic, HAPTIC_INTENSITY, HAPTIC_DURATION);
             }
             break;
+        case EV_REDRAW:
+            render ();
+            break;
+        case EV_TICK:
+            render_tick ();
+            break;
+        case EV_GAME_LOST:
+            if (haptic) {
+                SDL_HapticRumblePlay (haptic, 0.3f, 500);
+            }
+            break;
         default:
             printf ("Unhandled user event: %d\n", e->user.code);
             break;
@@ -262,20 +439,25 @@ handle_event (const SDL_Event *e)
     // Other
     case SDL_QUIT:
         return false;
+    case SDL_RENDER_TARGETS_RESET:
+        // The cached frame was lost.
+        render ();
+        break;
     case SDL_WINDOWEVENT:
         switch (e->window.event) {
         case SDL_WINDOWEVENT_RESIZED:
         case SDL_WINDOWEVENT_MAXIMIZED:
         case SDL_WINDOWEVENT_SHOWN: {
+            const struct board_view *v = game_view ();
             const int ts = t_size;
-            const float corner_x = (t_offX + t_width / 2) * ts / w_width;
-            const float corner_y = (t_offY + t_height / 2) * ts / w_height;
+            const float corner_x = (t_offX + v->width / 2) * ts / w_width;
+            const float corner_y = (t_offY + v->height / 2) * ts / w_height;
 
             SDL_GetWindowSize (window, &w_width, &w_height);
 
             // Adjust the center of the playing field.
-            t_offX = corner_x * w_width / ts - t_width / 2;
-            t_offY = corner_y * w_height / ts - t_height / 2;
+            t_offX = corner_x * w_width / ts - v->width / 2;
+            t_offY = corner_y * w_height / ts - v->height / 2;
 
             menu_update (w_width, w_height);
             dialog_update (w_width, w_height);
@@ -0,0 +1,290 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The running game is journaled to `journal.bin`, so it can be restored after
+ * a crash: a header with the parameters of the board, followed by one record
+ * per move.
+ *
+ * The game thread only appends to a buffer in memory. A writer thread writes
+ * the buffer and syncs it to disk after JOURNAL_SYNC_MOVES moves or
+ * JOURNAL_SYNC_MS, whichever comes first, so moves never wait on the disk.
+ *
+ * Once the game is over, the history has its result and the journal is
+ * truncated. A restored game only writes back the moves that changed the board.
+ *
+ * The file uses the native byte order.
+ */
+#include <SDL2/SDL_thread.h>
+#include <SDL2/SDL_mutex.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include "journal.h"
+#include "board.h"
+#include "util.h"
+#include "wire.h"
+#include "bsw.h"
+
+#define JOURNAL_VERSION 2
+
+static const char journal_magic[4] = { 'B', 'S', 'W', 'J' };
+
+static SDL_mutex *mutex;
+static SDL_cond *cond;
+static SDL_Thread *thread;
+static char *path;
+static int fd = -1;
+static bool quit_requested;
+static bool truncate_pending;               // Start over with the next write.
+static size_t n_pending;                    // Moves in `pending`.
+static struct buffer pending, writing;
+
+// The unfinished game found by journal_start().
+static bool has_restored;
+static struct journal_header restored;
+static struct journal_move *restored_moves;
+static size_t n_restored;
+
+static void
+journal_load (void)
+{
+    FILE *file;
+    long size;
+
+    file = fopen (path, "rb");
+    if (!file)
+        return;
+
+    // An empty journal means that there is no unfinished game.
+    fseek (file, 0, SEEK_END);
+    size = ftell (file);
+    fseek (file, 0, SEEK_SET);
+    if (size < (long)sizeof restored) {
+        fclose (file);
+        return;
+    }
+
+    if (fread (&restored, sizeof restored, 1, file) != 1
+        || memcmp (restored.magic, journal_magic, sizeof journal_magic) != 0
+        || restored.version != JOURNAL_VERSION) {
+        fprintf (stderr, "Invalid journal '%s', ignoring it.\n", path);
+        fclose (file);
+        return;
+    }
+
+    // A move that was only partially written is dropped.
+    n_restored = (size - sizeof restored) / sizeof (struct journal_move);
+    restored_moves = malloc (my_max (n_restored, 1) * sizeof (struct journal_move));
+    if (!restored_moves) {
+        perror ("malloc()");
+        abort ();
+    }
+    n_restored = fread (restored_moves, sizeof (struct journal_move), n_restored, file);
+    has_restored = true;
+    fclose (file);
+}
+
+static void
+journal_write (struct buffer *b, bool truncate)
+{
+    if (truncate && ftruncate (fd, 0) != 0)
+        fprintf (stderr, "Failed to truncate '%s': %s\n", path, strerror (errno));
+
+    for (size_t pos = 0; pos < b->len; ) {
+        const ssize_t n = write (fd, b->data + pos, b->len - pos);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            fprintf (stderr, "Failed to write '%s': %s\n", path, strerror (errno));
+            break;
+        }
+        pos += n;
+    }
+    b->len = 0;
+
+    if (fdatasync (fd) != 0)
+        fprintf (stderr, "Failed to sync '%s': %s\n", path, strerror (errno));
+}
+
+static int
+journal_thread (void *arg)
+{
+    (void)arg;
+
+    SDL_LockMutex (mutex);
+    while (true) {
+        if (!quit_requested && !truncate_pending && n_pending < JOURNAL_SYNC_MOVES)
+            SDL_CondWaitTimeout (cond, mutex, JOURNAL_SYNC_MS);
+
+        if (pending.len == 0 && !truncate_pending) {
+            if (quit_requested)
+                break;
+            continue;
+        }
+
+        // Write the moves so far, while the game thread fills the other buffer.
+        const bool truncate = truncate_pending;
+        const struct buffer tmp = pending;
+        pending = writing;
+        writing = tmp;
+        truncate_pending = false;
+        n_pending = 0;
+
+        SDL_UnlockMutex (mutex);
+        journal_write (&writing, truncate);
+        SDL_LockMutex (mutex);
+    }
+    SDL_UnlockMutex (mutex);
+    return 0;
+}
+
+bool
+journal_start (void)
+{
+    path = config_path ("journal.bin");
+    if (!path)
+        return true;
+
+    journal_load ();
+
+    char *dup = strdup (path);
+    dirname (dup);
+    mkdir_p (dup);
+    free (dup);
+
+    // Without a journal, the game still works; it just can't be restored.
+    fd = open (path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf (stderr, "Failed to open '%s': %s\n", path, strerror (errno));
+        return true;
+    }
+
+    mutex = SDL_CreateMutex ();
+    cond = SDL_CreateCond ();
+    if (!mutex || !cond) {
+        printf ("Failed to create journal: %s\n", SDL_GetError ());
+        return false;
+    }
+
+    thread = SDL_CreateThread (&journal_thread, "journal", NULL);
+    if (!thread) {
+        printf ("Failed to create journal thread: %s\n", SDL_GetError ());
+        return false;
+    }
+    return true;
+}
+
+void
+journal_quit (void)
+{
+    if (thread) {
+        SDL_LockMutex (mutex);
+        quit_requested = true;
+        SDL_CondSignal (cond);
+        SDL_UnlockMutex (mutex);
+        SDL_WaitThread (thread, NULL);
+        thread = NULL;
+    }
+    if (fd >= 0) {
+        close (fd);
+        fd = -1;
+    }
+
+    SDL_DestroyCond (cond);
+    SDL_DestroyMutex (mutex);
+    buf_free (&pending);
+    buf_free (&writing);
+    free (restored_moves);
+    free (path);
+    restored_moves = NULL;
+    path = NULL;
+}
+
+bool
+journal_restore (struct journal_header *hdr, struct journal_move **moves, size_t *n_moves)
+{
+    if (!has_restored)
+        return false;
+
+    *hdr = restored;
+    *moves = restored_moves;
+    *n_moves = n_restored;
+    has_restored = false;
+    restored_moves = NULL;
+    return true;
+}
+
+void
+journal_begin (const struct bsw_board *b, int first_x, int first_y)
+{
+    const struct journal_header hdr = {
+        .magic = { 'B', 'S', 'W', 'J' },
+        .version = JOURNAL_VERSION,
+        .width = b->width,
+        .height = b->height,
+        .n_mines = b->n_bombs,
+        .seed = b->seed,
+        .first_x = first_x,
+        .first_y = first_y,
+        .start_time = b->start_time,
+    };
+
+    if (!thread)
+        return;
+
+    SDL_LockMutex (mutex);
+    pending.len = 0;
+    n_pending = 0;
+    buf_put (&pending, &hdr, sizeof hdr);
+    truncate_pending = true;
+    SDL_CondSignal (cond);
+    SDL_UnlockMutex (mutex);
+}
+
+void
+journal_move (int x, int y, int which)
+{
+    const struct journal_move m = { x, (uint32_t)y | (uint32_t)which << 24 };
+
+    if (!thread)
+        return;
+
+    SDL_LockMutex (mutex);
+    buf_put (&pending, &m, sizeof m);
+    if (++n_pending == JOURNAL_SYNC_MOVES)
+        SDL_CondSignal (cond);
+    SDL_UnlockMutex (mutex);
+}
+
+void
+journal_clear (void)
+{
+    if (!thread)
+        return;
+
+    SDL_LockMutex (mutex);
+    pending.len = 0;
+    n_pending = 0;
+    truncate_pending = true;
+    SDL_CondSignal (cond);
+    SDL_UnlockMutex (mutex);
+}
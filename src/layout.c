@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "layout.h"
+
+static uint64_t
+splitmix64 (uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+    return x ^ (x >> 31);
+}
+
+static uint64_t
+feistel (const struct layout *l, uint64_t x)
+{
+    const uint64_t mask = ((uint64_t)1 << l->half_bits) - 1;
+    uint64_t left = x >> l->half_bits, right = x & mask;
+
+    for (int i = 0; i < LAYOUT_ROUNDS; ++i) {
+        const uint64_t next = left ^ (splitmix64 (right ^ l->keys[i]) & mask);
+        left = right;
+        right = next;
+    }
+    return left << l->half_bits | right;
+}
+
+static uint64_t
+feistel_inverse (const struct layout *l, uint64_t x)
+{
+    const uint64_t mask = ((uint64_t)1 << l->half_bits) - 1;
+    uint64_t left = x >> l->half_bits, right = x & mask;
+
+    for (int i = LAYOUT_ROUNDS - 1; i >= 0; --i) {
+        const uint64_t prev = right ^ (splitmix64 (left ^ l->keys[i]) & mask);
+        right = left;
+        left = prev;
+    }
+    return left << l->half_bits | right;
+}
+
+void
+layout_init (struct layout *l, uint64_t n_tiles, uint64_t n_mines, unsigned seed, uint64_t first)
+{
+    uint64_t key = splitmix64 (seed);
+
+    l->n_tiles = n_tiles;
+    l->n_mines = n_mines;
+    for (int i = 0; i < LAYOUT_ROUNDS; ++i)
+        l->keys[i] = key = splitmix64 (key);
+
+    // The smallest even number of bits that covers all tiles.
+    l->half_bits = 1;
+    while (l->half_bits < 32 && ((uint64_t)1 << (2 * l->half_bits)) < n_tiles)
+        ++l->half_bits;
+
+    l->first = first;
+    l->first_hit = first < n_tiles && layout_rank (l, first) < n_mines;
+}
+
+uint64_t
+layout_rank (const struct layout *l, uint64_t index)
+{
+    // The network permutes a range of up to 4 * n_tiles numbers, so this
+    // walks the cycle until it's back on the board, in < 4 steps on average.
+    do {
+        index = feistel (l, index);
+    } while (index >= l->n_tiles);
+    return index;
+}
+
+uint64_t
+layout_tile (const struct layout *l, uint64_t rank)
+{
+    do {
+        rank = feistel_inverse (l, rank);
+    } while (rank >= l->n_tiles);
+    return rank;
+}
+
+uint64_t
+layout_mine (const struct layout *l, uint64_t i)
+{
+    const uint64_t index = layout_tile (l, i);
+    return index != l->first ? index : layout_tile (l, l->n_mines);
+}
+
+bool
+layout_is_mine (const struct layout *l, uint64_t index)
+{
+    if (index == l->first)
+        return false;
+
+    const uint64_t rank = layout_rank (l, index);
+    return rank < l->n_mines || (l->first_hit && rank == l->n_mines);
+}
+
+void
+layout_code (char buffer[LAYOUT_CODE_MAX], int width, int height, int64_t n_mines, unsigned seed)
+{
+    snprintf (buffer, LAYOUT_CODE_MAX, "%dx%d-%" PRId64 "-%08x", width, height, n_mines, seed);
+}
+
+bool
+layout_parse_code (const char *code, int64_t *width, int64_t *height, int64_t *n_mines, unsigned *seed)
+{
+    char *endp;
+
+    *width = strtoll (code, &endp, 10);
+    if (*endp != 'x')
+        return false;
+    *height = strtoll (endp + 1, &endp, 10);
+    if (*endp != '-')
+        return false;
+    *n_mines = strtoll (endp + 1, &endp, 10);
+    if (*endp != '-')
+        return false;
+
+    const unsigned long long s = strtoull (endp + 1, &endp, 16);
+    if (*endp || s > UINT32_MAX)
+        return false;
+    *seed = s;
+    return true;
+}
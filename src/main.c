@@ -15,36 +15,70 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <sys/wait.h>
+#include <inttypes.h>
+#include <getopt.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
 #include <time.h>
+#include "spectate.h"
+#include "history.h"
+#include "journal.h"
+#include "heatmap.h"
+#include "layout.h"
 #include "dialog.h"
 #include "config.h"
+#include "export.h"
 #include "video.h"
-#include "tile.h"
+#include "bench.h"
+#include "serve.h"
+#include "game.h"
 #include "menu.h"
+#include "tile.h"
+#include "net.h"
+#include "bot.h"
+#include "mem.h"
 #include "bsw.h"
 
 SDL_Window *window;
 SDL_Renderer *renderer;
 SDL_Texture *sprite;
-bool game_over;
+struct bsw_board *board;
 static char **args;
-time_t start_time, end_time;
 
 void
 reset_game (void)
 {
-    game_over = false;
-    reset_tiles ();
+    const struct game_cmd cmd = { .type = GAME_CMD_RESET };
+    game_post (&cmd);
+}
+
+// Print what the default board would need.
+static void
+print_memory_needed (void)
+{
+    const size_t avail = mem_available ();
+
+    printf ("A %dx%d board needs %zu MiB", default_width, default_height,
+            mem_board_estimate (default_width, default_height) >> 20);
+    if (avail != SIZE_MAX) {
+        printf (", %zu MiB are available.\n", avail >> 20);
+    } else {
+        puts (".");
+    }
 }
 
 noreturn void
 relaunch (void)
 {
+    export_quit ();
+    spectate_quit ();
+    net_quit ();
+    game_quit ();
+    journal_quit ();
+    heatmap_quit ();
     video_quit ();
-    free (tiles);
     execv ("/proc/self/exe", args);
     _exit (1);
 }
@@ -52,12 +86,28 @@ relaunch (void)
 int
 main (int argc, char *argv[])
 {
+    static const struct option long_options[] = {
+        { "spectate-out", required_argument, NULL, 'O' },
+        { "spectate-in",  required_argument, NULL, 'I' },
+        { "bot",          no_argument,       NULL, 'B' },
+        { "board-file",   required_argument, NULL, 'F' },
+        { "board",        required_argument, NULL, 'b' },
+        { "bench",        required_argument, NULL, 'M' },
+        { "serve",        required_argument, NULL, 'S' },
+        { NULL, 0, NULL, 0 },
+    };
+    const char *host_port = NULL, *join_address = NULL;
+    const char *spectate_out_path = NULL, *spectate_in_path = NULL;
+    const char *board_file = NULL, *bench = NULL, *serve_path = NULL;
+    const char *error;
+    bool bot = false;
     int option;
 
     args = argv;
+    board = bsw_new ();
     load_settings ();
 
-    while ((option = getopt (argc, argv, ":hVr:s:n:")) != -1) {
+    while ((option = getopt_long (argc, argv, ":hVr:s:n:H:C:", long_options, NULL)) != -1) {
         char *endp;
         switch (option) {
         case 'h':
@@ -72,58 +122,181 @@ main (int argc, char *argv[])
                 "  -V                    Print the version.\n"
                 "  -s <width>x<height>   Specify the map size. (default: 10x10)\n"
                 "  -n <integer>          Specify how many bombs you want. (default: 10)\n"
+                "  -H <port>             Host a co-op game on <port>.\n"
+                "  -C <host>:<port>      Join the co-op game hosted at <host>:<port>.\n"
+                "  --spectate-out <path> Stream the game to a file, FIFO or Unix socket.\n"
+                "  --spectate-in <path>  Watch a streamed game (\"-\" for stdin).\n"
+                "  --bot                 Play without a window, using commands from stdin.\n"
+                "  --board-file <path>   Keep the board in a file, for boards larger than the memory.\n"
+                "  --board <code>        Play the board of a code (copied with 'c').\n"
+                "  --bench <name>        Run a benchmark without a window (counts, bbbv, serve, latency).\n"
+                "  --serve <path>        Serve games to bots on a Unix socket.\n"
                 "\n"
                 "Report bugs to <benni@stuerz.xyz>"
             );
             return 0;
         case 'V':
             printf ("%s v%s.\n", TITLE, MSW_VERSION);
+            print_memory_needed ();
             return 0;
-        case 's':
-            if (sscanf (optarg, "%dx%d", &default_width, &default_height) != 2) {
+        case 's': {
+            const long width = strtol (optarg, &endp, 10);
+            const long height = *endp == 'x' ? strtol (endp + 1, &endp, 10) : 0;
+            if (*endp || width < 1 || height < 1 || width > TILE_MAX_SIZE || height > TILE_MAX_SIZE) {
                 printf ("Invalid size: %s\n", optarg);
                 return 1;
             }
+            default_width = width;
+            default_height = height;
             break;
+        }
         case 'n':
-            default_n_mines = (int)strtol (optarg, &endp, 10);
-            if (*endp || default_n_mines < 1) {
+            errno = 0;
+            default_n_mines = strtoll (optarg, &endp, 10);
+            if (*endp || errno || default_n_mines < 1) {
                 printf ("Invalid number of bombs: %s\n", optarg);
                 return 1;
             }
             break;
+        case 'H':
+            host_port = optarg;
+            break;
+        case 'C':
+            join_address = optarg;
+            break;
+        case 'O':
+            spectate_out_path = optarg;
+            break;
+        case 'I':
+            spectate_in_path = optarg;
+            break;
+        case 'B':
+            bot = true;
+            break;
+        case 'F':
+            board_file = optarg;
+            break;
+        case 'M':
+            bench = optarg;
+            break;
+        case 'S':
+            serve_path = optarg;
+            break;
+        case 'b': {
+            int64_t width, height;
+            unsigned seed;
+            if (!layout_parse_code (optarg, &width, &height, &default_n_mines, &seed)
+                || width < 1 || height < 1 || width > TILE_MAX_SIZE || height > TILE_MAX_SIZE) {
+                printf ("Invalid board code: %s\n", optarg);
+                return 1;
+            }
+            default_width = width;
+            default_height = height;
+            bsw_next_seed (board, seed);
+            break;
+        }
         case '?':
-            printf ("Invalid option '-%c'.\n", optopt);
+            if (optopt) {
+                printf ("Invalid option '-%c'.\n", optopt);
+            } else {
+                printf ("Invalid option '%s'.\n", argv[optind - 1]);
+            }
             return 1;
         case ':':
-            printf ("Expected argument for option '-%c'.\n", optopt);
+            if (optopt == 'O' || optopt == 'I' || optopt == 'F' || optopt == 'b' || optopt == 'M' || optopt == 'S') {
+                printf ("Expected argument for option '%s'.\n", argv[optind - 1]);
+            } else {
+                printf ("Expected argument for option '-%c'.\n", optopt);
+            }
             return 1;
         }
     }
 
+    if (host_port && join_address) {
+        puts ("Cannot host and join a co-op game at the same time.");
+        return 1;
+    }
+    if (spectate_in_path && (host_port || join_address)) {
+        puts ("Cannot spectate and play a co-op game at the same time.");
+        return 1;
+    }
+
+    if ((error = bsw_check_size (default_width, default_height, default_n_mines))) {
+        printf ("Invalid board %dx%d with %" PRId64 " bombs: %s\n",
+                default_width, default_height, default_n_mines, error);
+        return 1;
+    }
+    if (board_file && !bsw_map_file (board, board_file))
+        return 1;
+    if (!bsw_check_memory (board, default_width, default_height))
+        return 1;
+
     // Game initialization.
     srand (time (NULL));
-    if (!init_tiles () || !video_init ())
+    if (bench)
+        return bench_run (bench, serve_path);
+    if (serve_path)
+        return serve_run (serve_path);
+    if (bot)
+        return bot_run ();
+    history_load ();
+    if (host_port && !net_host (host_port))
+        return 1;
+    if (join_address && !net_connect (join_address))
+        return 1;
+    if (spectate_in_path && !spectate_in (spectate_in_path))
+        return 1;
+    if (spectate_out_path && !spectate_out (spectate_out_path))
+        return 1;
+    if (!video_init ())
         return 1;
+    // Co-op clients and spectators don't own their board, so there is nothing to restore.
+    if (!join_address && !spectate_in_path && !journal_start ()) {
+        journal_quit ();
+        video_quit ();
+        return 1;
+    }
+    if (!heatmap_init () || !game_init () || !net_start () || !spectate_start ()) {
+        spectate_quit ();
+        net_quit ();
+        game_quit ();
+        journal_quit ();
+        heatmap_quit ();
+        video_quit ();
+        return 1;
+    }
 
     menu_init ();
     dialog_init ();
 
-    game_over = false;
     menu.shown = false;
 
     video_post_init ();
 
     render ();
 
+    int timeout = -1;
     while (true) {
         SDL_Event e;
+        bool event;
 
-        if (SDL_WaitEvent (&e) && !handle_event (&e))
+        // Sleep until the next event, or the next frame of an animation.
+        if (timeout < 0) {
+            event = SDL_WaitEvent (&e);
+        } else {
+            event = SDL_WaitEventTimeout (&e, timeout);
+        }
+        if (event && !handle_event (&e))
             break;
+        timeout = animate ();
     }
 
+    export_quit ();
+    spectate_quit ();
+    net_quit ();
+    game_quit ();
+    journal_quit ();
+    heatmap_quit ();
     video_quit ();
-    free (tiles);
     return 0;
 }
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "board.h"
+#include "util.h"
+#include "mem.h"
+
+static atomic_size_t used[N_MEM_KINDS];
+
+void
+mem_account (enum mem_kind kind, ptrdiff_t bytes)
+{
+    atomic_fetch_add (&used[kind], (size_t)bytes);
+}
+
+size_t
+mem_used (enum mem_kind kind)
+{
+    return atomic_load (&used[kind]);
+}
+
+size_t
+mem_total (void)
+{
+    size_t total = 0;
+    for (int i = 0; i < N_MEM_KINDS; ++i)
+        total += mem_used (i);
+    return total;
+}
+
+// Read a single number from a file, "max" is SIZE_MAX.
+static bool
+read_size (const char *path, size_t *value)
+{
+    FILE *file = fopen (path, "r");
+    char buffer[64];
+    bool ok = false;
+
+    if (!file)
+        return false;
+    if (fgets (buffer, sizeof buffer, file)) {
+        if (strncmp (buffer, "max", 3) == 0) {
+            *value = SIZE_MAX;
+            ok = true;
+        } else {
+            ok = sscanf (buffer, "%zu", value) == 1;
+        }
+    }
+    fclose (file);
+    return ok;
+}
+
+// Memory left in the cgroup (v2) of this process and all of its parents.
+static size_t
+cgroup_available (void)
+{
+    size_t avail = SIZE_MAX, limit, current;
+    char line[512], path[1024];
+    FILE *file;
+    char *dir = NULL;
+
+    file = fopen ("/proc/self/cgroup", "r");
+    if (!file)
+        return avail;
+    while (fgets (line, sizeof line, file)) {
+        if (strncmp (line, "0::", 3) == 0) {
+            dir = line + 3;
+            dir[strcspn (dir, "\n")] = '\0';
+            break;
+        }
+    }
+    fclose (file);
+
+    // cgroup v1 only has a single limit for the whole hierarchy.
+    if (!dir) {
+        if (read_size ("/sys/fs/cgroup/memory/memory.limit_in_bytes", &limit)
+            && read_size ("/sys/fs/cgroup/memory/memory.usage_in_bytes", &current))
+            avail = limit > current ? limit - current : 0;
+        return avail;
+    }
+
+    while (true) {
+        snprintf (path, sizeof path, "/sys/fs/cgroup%s/memory.max", dir);
+        if (read_size (path, &limit) && limit != SIZE_MAX) {
+            snprintf (path, sizeof path, "/sys/fs/cgroup%s/memory.current", dir);
+            if (read_size (path, &current))
+                avail = my_min (avail, limit > current ? limit - current : 0);
+        }
+
+        // Continue with the parent, "/a" becomes "/".
+        char *slash = strrchr (dir, '/');
+        if (!slash || slash[1] == '\0')
+            break;
+        slash[slash == dir] = '\0';
+    }
+    return avail;
+}
+
+size_t
+mem_available (void)
+{
+    size_t avail = SIZE_MAX, kb;
+    char line[256];
+    FILE *file;
+
+    file = fopen ("/proc/meminfo", "r");
+    if (file) {
+        while (fgets (line, sizeof line, file)) {
+            if (sscanf (line, "MemAvailable: %zu kB", &kb) == 1) {
+                avail = kb << 10;
+                break;
+            }
+        }
+        fclose (file);
+    }
+
+    return my_min (avail, cgroup_available ());
+}
+
+size_t
+mem_board_estimate (int width, int height)
+{
+    const size_t n_tiles = (size_t)width * height;
+
+    // Three views of one byte per tile, each with a pending list of up to 1/8 of the tiles.
+    const size_t views = 3 * (1 + sizeof (size_t) / 8);
+    // The list of changed tiles, if all of them changed.
+    const size_t changes = sizeof (size_t);
+    // The frontier of a cascade, or the opening index that replaces it:
+    // at most one span of 20 bytes per 4 tiles.
+    const size_t cascade = sizeof (struct tile *);
+    // The bit-planes of the bombs and zeros, whose rows are padded to whole words.
+    const size_t planes = 2 * (((size_t)width + 63) / 64) * sizeof (uint64_t) * height;
+
+    return n_tiles * (sizeof (struct tile) + views + changes + cascade) + planes;
+}
@@ -14,10 +14,12 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include "history.h"
 #include "video.h"
 #include "menu.h"
-#include "tile.h"
+#include "game.h"
 #include "util.h"
+#include "mem.h"
 #include "bsw.h"
 
 struct menu menu;
@@ -82,11 +84,10 @@ btn_addsub_bomb_on_click (struct menu_button *btn)
     default:
         abort ();
     }
-    default_width = my_clamp (t_width, 2, 999);
-    default_height = my_clamp (t_height, 2, 999);
-    default_n_mines = my_clamp (default_n_mines, 1, my_min (999, t_width * t_height - 1));
-    init_tiles ();
-    game_over = false;
+    default_width = my_clamp (default_width, 2, 999);
+    default_height = my_clamp (default_height, 2, 999);
+    default_n_mines = my_clamp (default_n_mines, 1, my_min (999, default_width * default_height - 1));
+    game_resize (default_width, default_height, default_n_mines);
     save_settings ();
     return true;
 }
@@ -132,8 +133,7 @@ btn_select_on_click(struct menu_button *btn)
     default_width   = default_presets[n][0];
     default_height  = default_presets[n][1];
     default_n_mines = default_presets[n][2];
-    init_tiles ();
-    game_over = false;
+    game_resize (default_width, default_height, default_n_mines);
     save_settings ();
     return true;
 }
@@ -226,11 +226,13 @@ button_update (struct menu_button *btn)
 }
 
 void
-menu_draw_int (unsigned value, unsigned len, int x0, int y0, int w, int h)
+menu_draw_int (uint64_t value, unsigned len, int x0, int y0, int w, int h)
 {
-    const unsigned max_val = powui (10, len) - 1;
+    uint64_t max_val = 0;
     SDL_Rect srect, rect;
 
+    for (unsigned i = 0; i < len; ++i)
+        max_val = max_val * 10 + 9;
     if (value > max_val)
         value = max_val;
 
@@ -249,7 +251,7 @@ menu_draw_int (unsigned value, unsigned len, int x0, int y0, int w, int h)
     SDL_RenderDrawRect (renderer, &rect);
 
     for (unsigned i = len; i != 0; --i) {
-        const unsigned digit = value % 10;
+        const unsigned digit = (unsigned)(value % 10);
         const unsigned x = i-1;
 
         rect.x = x0 + (x * w);
@@ -288,11 +290,25 @@ menu_draw (void)
     SDL_RenderDrawRect (renderer, &menu.rect);
 
     menu_draw_int (default_n_mines, 3, menu.rect.x + xt + 5, yt + 5, xt, yt);
-    menu_draw_int (t_width, 3, menu.rect.x + xt + 5, yt * 2 + 5, xt, yt);
-    menu_draw_int (t_height, 3, menu.rect.x + xt + 5, yt * 3 + 5, xt, yt);
+    menu_draw_int (default_width, 3, menu.rect.x + xt + 5, yt * 2 + 5, xt, yt);
+    menu_draw_int (default_height, 3, menu.rect.x + xt + 5, yt * 3 + 5, xt, yt);
 
     for (size_t i = 0; i < N_BUTTONS; ++i)
         draw_button (&menu.buttons[i]);
+
+    // Show the personal best of each preset.
+    for (int i = BTN_MIDGET; i <= BTN_NON_MIDGET; ++i) {
+        const SDL_Rect *r = &menu.buttons[i].wrect;
+        const int *preset = default_presets[i - BTN_MIDGET];
+        struct history_stats stats;
+
+        if (history_get (preset[0], preset[1], preset[2], &stats) && stats.best_ms != 0)
+            menu_draw_int (stats.best_ms / 1000, 4, r->x, r->y + r->h * 3 / 4, r->w / 4, r->h / 4);
+    }
+
+    // Show the memory used by the game in MiB.
+    menu_draw_int (mem_total () >> 20, 5, menu.rect.x + menu.rect.w - xt * 5 / 4 - 5,
+                   menu.rect.y + menu.rect.h - yt / 4 - 5, xt / 4, yt / 4);
 }
 bool
 menu_click (SDL_Point p, int button)
@@ -0,0 +1,641 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Local co-op over TCP.
+ *
+ * The host owns the board. Clients forward their moves to the host, which
+ * resolves them like its own. The host sends the board parameters (including
+ * the seed and first click) whenever a new board is created, and otherwise
+ * only the tiles that changed since the last published frame.
+ *
+ * The encoding of the messages is described in wire.h.
+ */
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include "video.h"
+#include "game.h"
+#include "tile.h"
+#include "util.h"
+#include "net.h"
+#include "bsw.h"
+
+struct client {
+    int fd;                                 // -1 if this slot is unused.
+    int id;
+    bool synced;                            // Received the board; gets broadcasts.
+    bool lagging;                           // Missed broadcasts, needs a sync once `out` is sent.
+    struct buffer in, out;
+};
+
+enum net_mode net_mode = NET_NONE;
+
+static SDL_Thread *thread;
+static SDL_mutex *mutex;                    // Protects the output buffers and `clients`.
+static int wake_pipe[2] = { -1, -1 };
+static atomic_bool quit_requested;
+
+// Host
+static int listen_fd = -1;
+static struct client clients[NET_MAX_CLIENTS];
+static int next_id;
+static bool last_game_over;
+
+// Client
+static struct client host = { .fd = -1 };
+static struct net_board *first_board;
+
+static void
+wake_up (void)
+{
+    const char c = 0;
+    if (write (wake_pipe[1], &c, 1) < 0 && errno != EAGAIN)
+        perror ("write()");
+}
+
+static bool
+set_nonblock (int fd)
+{
+    const int flags = fcntl (fd, F_GETFL);
+    return flags >= 0 && fcntl (fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+static bool
+init_common (void)
+{
+    mutex = SDL_CreateMutex ();
+    if (!mutex) {
+        printf ("Failed to create mutex: %s\n", SDL_GetError ());
+        return false;
+    }
+    if (pipe (wake_pipe) != 0 || !set_nonblock (wake_pipe[0]) || !set_nonblock (wake_pipe[1])) {
+        perror ("pipe()");
+        return false;
+    }
+    for (int i = 0; i < NET_MAX_CLIENTS; ++i)
+        clients[i].fd = -1;
+    return true;
+}
+
+// Read everything available; returns false, if the connection was closed.
+static bool
+conn_read (struct client *c)
+{
+    while (true) {
+        buf_reserve (&c->in, 4096);
+        const ssize_t n = recv (c->fd, c->in.data + c->in.len, c->in.cap - c->in.len, 0);
+        if (n > 0) {
+            c->in.len += n;
+        } else if (n == 0) {
+            return false;
+        } else {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+    }
+}
+
+// Write as much as possible; returns false, if the connection was closed.
+static bool
+conn_write (struct client *c)
+{
+    while (c->out.len > 0) {
+        const ssize_t n = send (c->fd, c->out.data, c->out.len, MSG_NOSIGNAL);
+        if (n < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        buf_consume (&c->out, n);
+    }
+    return true;
+}
+
+static void
+client_close (struct client *c)
+{
+    close (c->fd);
+    c->fd = -1;
+    buf_free (&c->in);
+    buf_free (&c->out);
+}
+
+// Append `msg` to the output of one or all synced clients. Clients that
+// don't keep up with the broadcasts stop getting them, until they are synced again.
+static void
+send_to (int client, const struct buffer *msg)
+{
+    SDL_LockMutex (mutex);
+    for (int i = 0; i < NET_MAX_CLIENTS; ++i) {
+        struct client *c = &clients[i];
+        if (c->fd < 0 || (client < 0 ? !c->synced : c->id != client))
+            continue;
+        if (client < 0 && c->out.len >= NET_MAX_OUTPUT) {
+            c->synced = false;
+            c->lagging = true;
+            continue;
+        }
+        buf_put (&c->out, msg->data, msg->len);
+    }
+    SDL_UnlockMutex (mutex);
+    wake_up ();
+}
+
+static bool
+host_handle_msg (enum msg_type type, const unsigned char *p, size_t len)
+{
+    struct game_cmd cmd;
+
+    if (type != MSG_CMD || len < 13)
+        return false;
+
+    memset (&cmd, 0, sizeof cmd);
+    cmd.type = p[0];
+    cmd.x = (int32_t)get_u32 (p + 1);
+    cmd.y = (int32_t)get_u32 (p + 5);
+    cmd.arg = (int32_t)get_u32 (p + 9);
+
+    switch (cmd.type) {
+    case GAME_CMD_CLICK:
+    case GAME_CMD_RESET:
+        break;
+    case GAME_CMD_RESIZE:
+        cmd.x = my_clamp (cmd.x, 2, 999);
+        cmd.y = my_clamp (cmd.y, 2, 999);
+        cmd.arg = my_clamp (cmd.arg, 1, my_min (999, cmd.x * cmd.y - 1));
+        break;
+    default:
+        return false;
+    }
+
+    game_queue (&cmd);
+    return true;
+}
+
+static void
+host_accept (void)
+{
+    const int fd = accept (listen_fd, NULL, NULL);
+    const int one = 1;
+    int slot = -1;
+
+    if (fd < 0)
+        return;
+
+    for (int i = 0; i < NET_MAX_CLIENTS; ++i) {
+        if (clients[i].fd < 0) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot < 0 || !set_nonblock (fd)) {
+        fputs ("Rejecting co-op client.\n", stderr);
+        close (fd);
+        return;
+    }
+    setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+    SDL_LockMutex (mutex);
+    clients[slot].fd = fd;
+    clients[slot].id = next_id++;
+    clients[slot].synced = false;
+    clients[slot].lagging = false;
+    SDL_UnlockMutex (mutex);
+
+    // Let the game thread send the current board.
+    const struct game_cmd cmd = { .type = GAME_CMD_SYNC, .arg = clients[slot].id };
+    game_queue (&cmd);
+    puts ("Co-op client connected.");
+}
+
+static int
+host_thread (void *arg)
+{
+    struct pollfd fds[NET_MAX_CLIENTS + 2];
+    (void)arg;
+
+    while (!atomic_load (&quit_requested)) {
+        fds[0].fd = wake_pipe[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = listen_fd;
+        fds[1].events = POLLIN;
+
+        SDL_LockMutex (mutex);
+        for (int i = 0; i < NET_MAX_CLIENTS; ++i) {
+            fds[i + 2].fd = clients[i].fd;
+            fds[i + 2].events = POLLIN | (clients[i].out.len ? POLLOUT : 0);
+        }
+        SDL_UnlockMutex (mutex);
+
+        if (poll (fds, arraylen (fds), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror ("poll()");
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            char buf[64];
+            while (read (wake_pipe[0], buf, sizeof buf) > 0);
+        }
+        if (fds[1].revents & POLLIN)
+            host_accept ();
+
+        for (int i = 0; i < NET_MAX_CLIENTS; ++i) {
+            struct client *c = &clients[i];
+            const short revents = fds[i + 2].revents;
+            bool ok = true, resync;
+
+            if (fds[i + 2].fd < 0 || !revents)
+                continue;
+
+            if (revents & (POLLIN | POLLHUP | POLLERR))
+                ok = conn_read (c);
+
+            while (ok) {
+                const unsigned char *payload;
+                enum msg_type type;
+                bool error = false;
+                size_t len;
+                const size_t n = msg_next (&c->in, &type, &payload, &len, &error);
+
+                if (error || (n && !host_handle_msg (type, payload, len)))
+                    ok = false;
+                if (!n)
+                    break;
+                buf_consume (&c->in, n);
+            }
+
+            SDL_LockMutex (mutex);
+            if (ok)
+                ok = conn_write (c);
+            if (!ok) {
+                client_close (c);
+                puts ("Co-op client disconnected.");
+            }
+            resync = ok && c->lagging && c->out.len == 0;
+            if (resync)
+                c->lagging = false;
+            SDL_UnlockMutex (mutex);
+
+            // Send the board again, instead of the broadcasts it missed.
+            if (resync) {
+                const struct game_cmd cmd = { .type = GAME_CMD_SYNC, .arg = c->id };
+                game_queue (&cmd);
+            }
+        }
+    }
+    return 0;
+}
+
+static bool
+client_handle_msg (enum msg_type type, const unsigned char *p, size_t len)
+{
+    struct game_cmd cmd;
+
+    memset (&cmd, 0, sizeof cmd);
+    switch (type) {
+    case MSG_BOARD:
+        cmd.type = GAME_CMD_REMOTE_BOARD;
+        cmd.data = wire_get_board (p, len);
+        break;
+    case MSG_DELTA:
+        cmd.type = GAME_CMD_REMOTE_DELTA;
+        cmd.data = wire_get_delta (p, len);
+        break;
+    default:
+        return false;
+    }
+
+    if (!cmd.data)
+        return false;
+    game_queue (&cmd);
+    return true;
+}
+
+static int
+client_thread (void *arg)
+{
+    (void)arg;
+
+    while (!atomic_load (&quit_requested)) {
+        struct pollfd fds[2];
+        bool ok = true;
+
+        fds[0].fd = wake_pipe[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = host.fd;
+        SDL_LockMutex (mutex);
+        fds[1].events = POLLIN | (host.out.len ? POLLOUT : 0);
+        SDL_UnlockMutex (mutex);
+
+        if (poll (fds, arraylen (fds), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror ("poll()");
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            char buf[64];
+            while (read (wake_pipe[0], buf, sizeof buf) > 0);
+        }
+
+        if (fds[1].revents & (POLLIN | POLLHUP | POLLERR))
+            ok = conn_read (&host);
+
+        while (ok) {
+            const unsigned char *payload;
+            enum msg_type type;
+            bool error = false;
+            size_t len;
+            const size_t n = msg_next (&host.in, &type, &payload, &len, &error);
+
+            if (error || (n && !client_handle_msg (type, payload, len)))
+                ok = false;
+            if (!n)
+                break;
+            buf_consume (&host.in, n);
+        }
+
+        SDL_LockMutex (mutex);
+        if (ok)
+            ok = conn_write (&host);
+        SDL_UnlockMutex (mutex);
+
+        if (!ok) {
+            SDL_Event e;
+
+            fputs ("Lost connection to the co-op host.\n", stderr);
+            SDL_zero (e);
+            e.type = SDL_QUIT;
+            SDL_PushEvent (&e);
+            break;
+        }
+    }
+    return 0;
+}
+
+bool
+net_host (const char *port)
+{
+    struct addrinfo hints, *res, *ai;
+    const int one = 1;
+    int err;
+
+    if (!init_common ())
+        return false;
+
+    memset (&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if ((err = getaddrinfo (NULL, port, &hints, &res)) != 0) {
+        printf ("Invalid port '%s': %s\n", port, gai_strerror (err));
+        return false;
+    }
+
+    for (ai = res; ai; ai = ai->ai_next) {
+        listen_fd = socket (ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (listen_fd < 0)
+            continue;
+        setsockopt (listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+        if (bind (listen_fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen (listen_fd, 8) == 0)
+            break;
+        close (listen_fd);
+        listen_fd = -1;
+    }
+    freeaddrinfo (res);
+
+    if (listen_fd < 0 || !set_nonblock (listen_fd)) {
+        printf ("Failed to listen on port %s: %s\n", port, strerror (errno));
+        return false;
+    }
+
+    net_mode = NET_HOST;
+    printf ("Hosting a co-op game on port %s.\n", port);
+    return true;
+}
+
+bool
+net_connect (const char *address)
+{
+    struct addrinfo hints, *res, *ai;
+    const unsigned char *payload;
+    enum msg_type type;
+    bool error = false;
+    char *name, *port;
+    const int one = 1;
+    size_t len, n;
+    int err;
+
+    if (!init_common ())
+        return false;
+
+    name = strdup (address);
+    port = strrchr (name, ':');
+    if (!port) {
+        printf ("Invalid address '%s', expected <host>:<port>.\n", address);
+        free (name);
+        return false;
+    }
+    *port++ = '\0';
+
+    memset (&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    err = getaddrinfo (name, port, &hints, &res);
+    free (name);
+    if (err != 0) {
+        printf ("Failed to resolve '%s': %s\n", address, gai_strerror (err));
+        return false;
+    }
+
+    for (ai = res; ai; ai = ai->ai_next) {
+        host.fd = socket (ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (host.fd < 0)
+            continue;
+        if (connect (host.fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        close (host.fd);
+        host.fd = -1;
+    }
+    freeaddrinfo (res);
+
+    if (host.fd < 0) {
+        printf ("Failed to connect to '%s': %s\n", address, strerror (errno));
+        return false;
+    }
+    setsockopt (host.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+    // Wait for the board, so the window can be set up for it.
+    while (!(n = msg_next (&host.in, &type, &payload, &len, &error))) {
+        buf_reserve (&host.in, 4096);
+        const ssize_t r = recv (host.fd, host.in.data + host.in.len, host.in.cap - host.in.len, 0);
+        if (error || r <= 0) {
+            printf ("Failed to receive the board from '%s'.\n", address);
+            return false;
+        }
+        host.in.len += r;
+    }
+    if (type != MSG_BOARD || !(first_board = wire_get_board (payload, len))) {
+        printf ("Invalid board received from '%s'.\n", address);
+        return false;
+    }
+    buf_consume (&host.in, n);
+
+    default_width = first_board->width;
+    default_height = first_board->height;
+    default_n_mines = first_board->n_mines;
+
+    if (!set_nonblock (host.fd)) {
+        perror ("fcntl()");
+        return false;
+    }
+
+    net_mode = NET_CLIENT;
+    printf ("Joined the co-op game at %s.\n", address);
+    return true;
+}
+
+bool
+net_start (void)
+{
+    if (net_mode == NET_NONE)
+        return true;
+
+    if (net_mode == NET_CLIENT) {
+        const struct game_cmd cmd = { .type = GAME_CMD_REMOTE_BOARD, .data = first_board };
+        first_board = NULL;
+        game_queue (&cmd);
+    }
+
+    thread = SDL_CreateThread (net_mode == NET_HOST ? &host_thread : &client_thread, "net", NULL);
+    if (!thread) {
+        printf ("Failed to create network thread: %s\n", SDL_GetError ());
+        return false;
+    }
+    return true;
+}
+
+void
+net_quit (void)
+{
+    if (net_mode == NET_NONE)
+        return;
+
+    if (thread) {
+        atomic_store (&quit_requested, true);
+        wake_up ();
+        SDL_WaitThread (thread, NULL);
+        thread = NULL;
+    }
+
+    SDL_LockMutex (mutex);
+    net_mode = NET_NONE;
+    for (int i = 0; i < NET_MAX_CLIENTS; ++i) {
+        if (clients[i].fd >= 0)
+            client_close (&clients[i]);
+    }
+    if (host.fd >= 0)
+        client_close (&host);
+    if (listen_fd >= 0)
+        close (listen_fd);
+    listen_fd = -1;
+    SDL_UnlockMutex (mutex);
+
+    free (first_board);
+    close (wake_pipe[0]);
+    close (wake_pipe[1]);
+}
+
+void
+net_send_board (int client, int first_x, int first_y)
+{
+    struct buffer msg = { 0 };
+
+    if (net_mode != NET_HOST)
+        return;
+
+    wire_put_board (&msg, board, first_x, first_y);
+    if (client < 0)
+        last_game_over = false;
+    send_to (client, &msg);
+    buf_free (&msg);
+}
+
+void
+net_send_delta (int client, const size_t *changes, size_t n)
+{
+    struct buffer msg = { 0 };
+
+    if (net_mode != NET_HOST || (client < 0 && n == 0 && board->game_over == last_game_over))
+        return;
+
+    wire_put_delta (&msg, board, changes, n);
+    if (client < 0)
+        last_game_over = board->game_over;
+    send_to (client, &msg);
+    buf_free (&msg);
+}
+
+void
+net_sync (int client, int first_x, int first_y)
+{
+    size_t *changed, n;
+
+    if (net_mode != NET_HOST)
+        return;
+
+    // Describe the current board as a delta from a fresh one.
+    n = wire_board_changes (board, &changed);
+    net_send_board (client, first_x, first_y);
+    net_send_delta (client, changed, n);
+    free (changed);
+
+    SDL_LockMutex (mutex);
+    for (int i = 0; i < NET_MAX_CLIENTS; ++i) {
+        if (clients[i].fd >= 0 && clients[i].id == client)
+            clients[i].synced = true;
+    }
+    SDL_UnlockMutex (mutex);
+}
+
+void
+net_send_cmd (const struct game_cmd *cmd)
+{
+    size_t pos;
+
+    SDL_LockMutex (mutex);
+    if (net_mode == NET_CLIENT && host.fd >= 0) {
+        pos = msg_begin (&host.out, MSG_CMD);
+        buf_put_u8 (&host.out, cmd->type);
+        buf_put_u32 (&host.out, cmd->x);
+        buf_put_u32 (&host.out, cmd->y);
+        buf_put_u32 (&host.out, cmd->arg);
+        msg_end (&host.out, pos);
+    }
+    SDL_UnlockMutex (mutex);
+    wake_up ();
+}
@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <sys/mman.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "board.h"
+#include "pool.h"
+#include "mem.h"
+
+#define N_CLASSES 13                        // POOL_MIN_BLOCK << (N_CLASSES - 1) == POOL_MAX_BLOCK.
+#define POOL_RELEASE_MIN (1 << 20)          // Larger free blocks give their pages back.
+
+// Free blocks are linked through their first bytes.
+struct block {
+    struct block *next;
+};
+
+struct chunk {
+    struct chunk *next;
+    char *base;
+};
+
+struct bsw_pool {
+    struct block *free[N_CLASSES];
+    struct chunk *chunks;
+    char *bump, *end;                       // Unused part of the newest chunk.
+    struct bsw_board *boards;               // Freed boards, linked through `next_free`.
+};
+
+struct bsw_pool *
+bsw_pool_new (void)
+{
+    struct bsw_pool *pool = calloc (1, sizeof *pool);
+
+    if (!pool) {
+        perror ("calloc()");
+        abort ();
+    }
+    return pool;
+}
+
+void
+bsw_pool_free (struct bsw_pool *pool)
+{
+    if (!pool)
+        return;
+
+    while (pool->boards) {
+        struct bsw_board *b = pool->boards;
+        pool->boards = b->next_free;
+        b->pool = NULL;
+        bsw_free (b);
+    }
+    while (pool->chunks) {
+        struct chunk *c = pool->chunks;
+        pool->chunks = c->next;
+        munmap (c->base, POOL_CHUNK);
+        mem_account (MEM_BOARD, -(ptrdiff_t)POOL_CHUNK);
+        free (c);
+    }
+    free (pool);
+}
+
+static int
+size_class (size_t size)
+{
+    int class = 0;
+
+    while (((size_t)POOL_MIN_BLOCK << class) < size)
+        ++class;
+    return class;
+}
+
+// Put the rest of the newest chunk into the free lists.
+static void
+retire_chunk (struct bsw_pool *pool)
+{
+    for (int class = N_CLASSES - 1; class >= 0; --class) {
+        const size_t size = (size_t)POOL_MIN_BLOCK << class;
+        while ((size_t)(pool->end - pool->bump) >= size) {
+            pool_give (pool, pool->bump, size);
+            pool->bump += size;
+        }
+    }
+}
+
+static bool
+add_chunk (struct bsw_pool *pool)
+{
+    struct chunk *c = malloc (sizeof *c);
+    char *base;
+
+    if (!c)
+        return false;
+    base = mmap (NULL, POOL_CHUNK, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        free (c);
+        return false;
+    }
+    mem_account (MEM_BOARD, POOL_CHUNK);
+
+    retire_chunk (pool);
+    c->base = base;
+    c->next = pool->chunks;
+    pool->chunks = c;
+    pool->bump = base;
+    pool->end = base + POOL_CHUNK;
+    return true;
+}
+
+void *
+pool_take (struct bsw_pool *pool, size_t *size)
+{
+    if (*size > POOL_MAX_BLOCK)
+        return NULL;
+
+    const int class = size_class (*size);
+    struct block *block = pool->free[class];
+
+    *size = (size_t)POOL_MIN_BLOCK << class;
+    if (block) {
+        pool->free[class] = block->next;
+        return block;
+    }
+
+    if ((size_t)(pool->end - pool->bump) < *size && !add_chunk (pool))
+        return NULL;
+    block = (struct block *)pool->bump;
+    pool->bump += *size;
+    return block;
+}
+
+void
+pool_give (struct bsw_pool *pool, void *ptr, size_t size)
+{
+    struct block *block = ptr;
+    const int class = size_class (size);
+
+    // Only the page with the link stays.
+    if (size >= POOL_RELEASE_MIN) {
+        const uintptr_t page = sysconf (_SC_PAGESIZE);
+        const uintptr_t start = ((uintptr_t)(block + 1) + page - 1) & ~(page - 1);
+        const uintptr_t end = ((uintptr_t)ptr + size) & ~(page - 1);
+        if (start < end)
+            madvise ((void *)start, end - start, MADV_DONTNEED);
+    }
+    block->next = pool->free[class];
+    pool->free[class] = block;
+}
+
+void
+pool_keep_board (struct bsw_pool *pool, struct bsw_board *b)
+{
+    b->next_free = pool->boards;
+    pool->boards = b;
+}
+
+struct bsw_board *
+pool_take_board (struct bsw_pool *pool)
+{
+    struct bsw_board *b = pool->boards;
+
+    if (b)
+        pool->boards = b->next_free;
+    return b;
+}
@@ -0,0 +1,517 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * Board server: many independent games for bots on one Unix socket.
+ *
+ * Every connection plays its own game, with the same commands and answers
+ * as the bot mode (bot.c). The acceptor thread spreads the connections over
+ * the workers, which multiplex their connections with epoll. A worker owns
+ * the games of its connections, so they need no locks, and takes their
+ * boards from its own pool.
+ *
+ * Games without a command for SERVE_IDLE_MS are evicted: the connection is
+ * answered with "e idle" and closed, and its board goes back to the pool.
+ * Boards are generated and revealed in one go, so they are limited to
+ * SERVE_MAX_TILES tiles.
+ */
+#include <SDL2/SDL_cpuinfo.h>
+#include <SDL2/SDL_thread.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include "serve.h"
+#include "board.h"
+#include "pool.h"
+#include "util.h"
+#include "wire.h"
+#include "bot.h"
+
+#define SERVE_EVENTS 256                    // Events handled per epoll_wait().
+
+struct conn {
+    int fd;
+    struct bsw_board *board;
+    struct buffer in, out;
+    uint32_t events;                        // What epoll waits for.
+    bool closing;                           // Close, once everything was sent.
+    uint64_t last_ms;                       // monotonic_ms() of the last command.
+    struct conn *prev, *next;               // Connections of the worker by `last_ms`, or free ones.
+};
+
+struct worker {
+    SDL_Thread *thread;
+    int epoll_fd;
+    int pipe[2];                            // Accepted connections; closed to quit.
+    struct bsw_pool *pool;
+    struct conn *oldest, *newest;
+    struct conn *free_conns;
+};
+
+static struct worker workers[SERVE_MAX_WORKERS];
+static int n_workers;
+static SDL_Thread *acceptor;
+static int listen_fd = -1, stop_fd = -1;
+static char *socket_path;
+
+static bool
+set_nonblock (int fd)
+{
+    const int flags = fcntl (fd, F_GETFL);
+    return flags >= 0 && fcntl (fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+static void
+conn_unlink (struct worker *w, struct conn *c)
+{
+    if (c->prev) {
+        c->prev->next = c->next;
+    } else {
+        w->oldest = c->next;
+    }
+    if (c->next) {
+        c->next->prev = c->prev;
+    } else {
+        w->newest = c->prev;
+    }
+}
+
+static void
+conn_append (struct worker *w, struct conn *c)
+{
+    c->prev = w->newest;
+    c->next = NULL;
+    if (w->newest) {
+        w->newest->next = c;
+    } else {
+        w->oldest = c;
+    }
+    w->newest = c;
+}
+
+// The game is in use, so it's evicted last.
+static void
+conn_touch (struct worker *w, struct conn *c)
+{
+    c->last_ms = monotonic_ms ();
+    if (c != w->newest) {
+        conn_unlink (w, c);
+        conn_append (w, c);
+    }
+}
+
+static void
+conn_close (struct worker *w, struct conn *c)
+{
+    conn_unlink (w, c);
+    close (c->fd);
+    bsw_free (c->board);
+
+    // The connection is kept for the next one, but not a large buffer.
+    c->in.len = c->out.len = 0;
+    if (c->out.cap > SERVE_MAX_LINE)
+        buf_free (&c->out);
+    c->next = w->free_conns;
+    w->free_conns = c;
+}
+
+static void
+conn_adopt (struct worker *w, int fd)
+{
+    struct conn *c = w->free_conns;
+    struct epoll_event ev = { .events = EPOLLIN };
+
+    if (c) {
+        w->free_conns = c->next;
+    } else if (!(c = calloc (1, sizeof *c))) {
+        perror ("calloc()");
+        abort ();
+    }
+
+    c->fd = fd;
+    c->board = bsw_new_in (w->pool);
+    c->events = ev.events;
+    c->closing = false;
+    c->last_ms = monotonic_ms ();
+    conn_append (w, c);
+
+    ev.data.ptr = c;
+    if (epoll_ctl (w->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        perror ("epoll_ctl()");
+        conn_close (w, c);
+    }
+}
+
+// Read everything available, up to SERVE_MAX_LINE; returns false, if the connection was closed.
+static bool
+conn_read (struct conn *c)
+{
+    while (c->in.len < SERVE_MAX_LINE) {
+        buf_reserve (&c->in, 4096);
+        const size_t space = c->in.cap - c->in.len;
+        const ssize_t n = recv (c->fd, c->in.data + c->in.len, space, 0);
+        if (n > 0) {
+            c->in.len += n;
+            // A short read emptied the socket, which saves the recv() that fails with EAGAIN.
+            if ((size_t)n < space)
+                return true;
+        } else if (n == 0) {
+            return false;
+        } else {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+    }
+    return true;
+}
+
+// Write as much as possible; returns false, if the connection was closed.
+static bool
+conn_write (struct conn *c)
+{
+    while (c->out.len > 0) {
+        const ssize_t n = send (c->fd, c->out.data, c->out.len, MSG_NOSIGNAL);
+        if (n < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        buf_consume (&c->out, n);
+    }
+    return true;
+}
+
+// Wait for input, unless too much output is pending, and for the output to drain.
+static bool
+conn_watch (struct worker *w, struct conn *c)
+{
+    const uint32_t events = (c->closing || c->out.len >= SERVE_MAX_OUTPUT ? 0 : EPOLLIN)
+                          | (c->out.len != 0 ? EPOLLOUT : 0);
+    struct epoll_event ev = { .events = events, .data.ptr = c };
+
+    if (events == c->events)
+        return true;
+    c->events = events;
+    return epoll_ctl (w->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev) == 0;
+}
+
+// Whether a complete command is waiting for an answer.
+static bool
+has_line (const struct conn *c)
+{
+    return c->in.len != 0 && memchr (c->in.data, '\n', c->in.len) != NULL;
+}
+
+static void
+conn_event (struct worker *w, struct conn *c, uint32_t events)
+{
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        const size_t len = c->in.len;
+        if (!conn_read (c))
+            c->closing = true;
+        if (c->in.len != len)
+            conn_touch (w, c);
+    }
+
+    // The commands that were held back by pending output are answered,
+    // once it was sent.
+    do {
+        if (c->out.len < SERVE_MAX_OUTPUT) {
+            // Like in the bot mode, the end of the input ends the last line.
+            if (c->closing && c->in.len != 0 && c->in.data[c->in.len - 1] != '\n')
+                buf_put_u8 (&c->in, '\n');
+            bot_handle (c->board, &c->in, &c->out, SERVE_MAX_TILES);
+            if (c->in.len >= SERVE_MAX_LINE) {
+                buf_put (&c->out, "e line too long\n", 16);
+                c->closing = true;
+            }
+        }
+        if (!conn_write (c)) {
+            conn_close (w, c);
+            return;
+        }
+    } while (c->out.len < SERVE_MAX_OUTPUT && has_line (c));
+
+    if ((c->closing && c->out.len == 0 && !has_line (c)) || !conn_watch (w, c))
+        conn_close (w, c);
+}
+
+// Evict the games that were idle for too long.
+// Returns the milliseconds until the next one expires, or -1.
+static int
+evict_idle (struct worker *w)
+{
+    const uint64_t now = monotonic_ms ();
+
+    while (w->oldest && now - w->oldest->last_ms >= SERVE_IDLE_MS) {
+        struct conn *c = w->oldest;
+        buf_put (&c->out, "e idle\n", 7);
+        conn_write (c);
+        conn_close (w, c);
+    }
+    return w->oldest ? (int)(w->oldest->last_ms + SERVE_IDLE_MS - now) : -1;
+}
+
+// Take the connections passed by the acceptor; returns false, once the pipe was closed.
+static bool
+adopt_all (struct worker *w)
+{
+    int fds[64];
+    ssize_t n;
+
+    // Every fd was written at once, so they are never split.
+    while ((n = read (w->pipe[0], fds, sizeof fds)) > 0) {
+        for (size_t i = 0; i < (size_t)n / sizeof (int); ++i)
+            conn_adopt (w, fds[i]);
+    }
+    return n != 0;
+}
+
+static int
+worker_thread (void *arg)
+{
+    struct worker *w = arg;
+    struct epoll_event events[SERVE_EVENTS];
+    bool running = true;
+
+    while (running) {
+        const int n = epoll_wait (w->epoll_fd, events, SERVE_EVENTS, evict_idle (w));
+        if (n < 0 && errno != EINTR) {
+            perror ("epoll_wait()");
+            break;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            if (events[i].data.ptr) {
+                conn_event (w, events[i].data.ptr, events[i].events);
+            } else {
+                running = adopt_all (w);
+            }
+        }
+    }
+
+    while (w->oldest)
+        conn_close (w, w->oldest);
+    while (w->free_conns) {
+        struct conn *c = w->free_conns;
+        w->free_conns = c->next;
+        buf_free (&c->in);
+        buf_free (&c->out);
+        free (c);
+    }
+    return 0;
+}
+
+static int
+acceptor_thread (void *arg)
+{
+    struct pollfd fds[2] = {
+        { .fd = listen_fd, .events = POLLIN },
+        { .fd = stop_fd, .events = POLLIN },
+    };
+    int next = 0;
+
+    (void)arg;
+    while (true) {
+        if (poll (fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror ("poll()");
+            break;
+        }
+        if (fds[1].revents)
+            break;
+        if (!(fds[0].revents & POLLIN))
+            continue;
+
+        const int fd = accept (listen_fd, NULL, NULL);
+        if (fd < 0) {
+            // Don't spin, while no more files can be opened.
+            if (errno == EMFILE || errno == ENFILE)
+                SDL_Delay (100);
+            continue;
+        }
+
+        // Spread the games evenly over the workers.
+        if (!set_nonblock (fd) || write (workers[next].pipe[1], &fd, sizeof fd) != sizeof fd)
+            close (fd);
+        next = (next + 1) % n_workers;
+    }
+    return 0;
+}
+
+// Whether a server is listening on `addr`.
+static bool
+socket_alive (const struct sockaddr_un *addr)
+{
+    const int fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    bool alive;
+
+    if (fd < 0)
+        return true;
+    alive = connect (fd, (const struct sockaddr *)addr, sizeof *addr) == 0 || errno != ECONNREFUSED;
+    close (fd);
+    return alive;
+}
+
+static int
+listen_unix (const char *path)
+{
+    struct sockaddr_un addr;
+    int fd, err;
+
+    if (strlen (path) >= sizeof addr.sun_path) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memset (&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy (addr.sun_path, path);
+
+    fd = socket (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    // Take over the socket of a server that is gone.
+    if (bind (fd, (struct sockaddr *)&addr, sizeof addr) != 0) {
+        if (errno != EADDRINUSE || socket_alive (&addr) || unlink (path) != 0
+            || bind (fd, (struct sockaddr *)&addr, sizeof addr) != 0)
+            goto fail;
+    }
+    if (listen (fd, SOMAXCONN) == 0)
+        return fd;
+
+fail:
+    err = errno;
+    close (fd);
+    errno = err;
+    return -1;
+}
+
+static bool
+start_worker (struct worker *w)
+{
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+
+    w->pool = bsw_pool_new ();
+    w->epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+    if (w->epoll_fd < 0 || pipe (w->pipe) != 0 || !set_nonblock (w->pipe[0])
+        || epoll_ctl (w->epoll_fd, EPOLL_CTL_ADD, w->pipe[0], &ev) != 0) {
+        perror ("Failed to set up a worker");
+        return false;
+    }
+
+    w->thread = SDL_CreateThread (&worker_thread, "serve", w);
+    if (!w->thread) {
+        printf ("Failed to create a worker: %s\n", SDL_GetError ());
+        return false;
+    }
+    return true;
+}
+
+bool
+serve_start (const char *path)
+{
+    listen_fd = listen_unix (path);
+    if (listen_fd < 0) {
+        printf ("Failed to listen on '%s': %s\n", path, strerror (errno));
+        return false;
+    }
+    socket_path = strdup (path);
+    raise_file_limit ();
+
+    n_workers = my_clamp (SDL_GetCPUCount (), 1, SERVE_MAX_WORKERS);
+    for (int i = 0; i < n_workers; ++i)
+        workers[i].epoll_fd = workers[i].pipe[0] = workers[i].pipe[1] = -1;
+    for (int i = 0; i < n_workers; ++i) {
+        if (!start_worker (&workers[i])) {
+            serve_stop ();
+            return false;
+        }
+    }
+
+    stop_fd = eventfd (0, EFD_CLOEXEC);
+    acceptor = stop_fd >= 0 ? SDL_CreateThread (&acceptor_thread, "accept", NULL) : NULL;
+    if (!acceptor) {
+        printf ("Failed to create the acceptor: %s\n", stop_fd >= 0 ? SDL_GetError () : strerror (errno));
+        serve_stop ();
+        return false;
+    }
+    return true;
+}
+
+void
+serve_stop (void)
+{
+    if (acceptor) {
+        eventfd_write (stop_fd, 1);
+        SDL_WaitThread (acceptor, NULL);
+        acceptor = NULL;
+    }
+
+    for (int i = 0; i < n_workers; ++i) {
+        struct worker *w = &workers[i];
+
+        if (w->pipe[1] >= 0)
+            close (w->pipe[1]);
+        if (w->thread)
+            SDL_WaitThread (w->thread, NULL);
+        if (w->pipe[0] >= 0)
+            close (w->pipe[0]);
+        if (w->epoll_fd >= 0)
+            close (w->epoll_fd);
+        bsw_pool_free (w->pool);
+        memset (w, 0, sizeof *w);
+    }
+    n_workers = 0;
+
+    if (stop_fd >= 0)
+        close (stop_fd);
+    if (listen_fd >= 0)
+        close (listen_fd);
+    stop_fd = listen_fd = -1;
+    if (socket_path)
+        unlink (socket_path);
+    free (socket_path);
+    socket_path = NULL;
+}
+
+int
+serve_run (const char *path)
+{
+    sigset_t set;
+    int sig;
+
+    // Block the signals before any thread is created, so only sigwait() gets them.
+    sigemptyset (&set);
+    sigaddset (&set, SIGINT);
+    sigaddset (&set, SIGTERM);
+    sigprocmask (SIG_BLOCK, &set, NULL);
+
+    if (!serve_start (path))
+        return 1;
+    printf ("Serving games on '%s' with %d workers.\n", path, n_workers);
+
+    sigwait (&set, &sig);
+    serve_stop ();
+    return 0;
+}
@@ -0,0 +1,542 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Spectator stream.
+ *
+ * The stream starts with "BSWS" and the version (u32), followed by records
+ * of a timestamp in milliseconds (u32) and a MSG_BOARD or MSG_DELTA message
+ * as described in wire.h.
+ *
+ * The game thread appends records to a single-producer, single-consumer ring
+ * buffer, which is drained by a writer thread. If the consumer falls behind
+ * and the ring is full, records are dropped and the next record is replaced
+ * by a snapshot of the whole board instead. A snapshot that doesn't fit into
+ * the ring is handed to the writer as a whole, which sends it at its place
+ * in the stream; the records after it keep going through the ring.
+ */
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <stdatomic.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include "spectate.h"
+#include "video.h"
+#include "game.h"
+#include "tile.h"
+#include "util.h"
+#include "wire.h"
+#include "mem.h"
+#include "bsw.h"
+
+#define POLL_MS 100                         // How often the threads check for quit.
+
+bool spectating = false;
+
+static SDL_Thread *reader, *writer;
+static atomic_bool quit_requested;
+
+// Writer
+static const char *out_path;
+static int out_fd = -1;
+static unsigned char *ring;
+static atomic_size_t ring_head, ring_tail;  // Total bytes written and read.
+static SDL_sem *ring_sem;                   // Posted when the ring stops being empty.
+static atomic_bool active;                  // False once the stream is closed.
+static struct buffer scratch;
+static bool resync;                         // Records were dropped; send a snapshot.
+static struct buffer snapshot;              // A snapshot larger than the ring,
+static size_t snapshot_pos;                 // sent once the ring was written up to here,
+static size_t snapshot_sent;                // of which this much was written.
+static atomic_bool snapshot_ready;          // `snapshot` belongs to the writer.
+static bool last_game_over;
+static int board_x, board_y;
+static Uint32 start_ticks;
+
+// Reader
+static int in_fd = -1;
+static struct buffer in;
+static struct net_board *first_board;
+static Uint32 base_ticks;                   // When the record with timestamp 0 is due.
+
+static bool
+set_nonblock (int fd)
+{
+    const int flags = fcntl (fd, F_GETFL);
+    return flags >= 0 && fcntl (fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+static void
+put_header (struct buffer *b)
+{
+    buf_put (b, "BSWS", 4);
+    buf_put_u32 (b, SPECTATE_VERSION);
+}
+
+// Try to append `n` bytes to the ring, without waiting for the writer.
+static bool
+ring_push (const void *data, size_t n)
+{
+    const size_t head = atomic_load_explicit (&ring_head, memory_order_relaxed);
+    const size_t tail = atomic_load_explicit (&ring_tail, memory_order_acquire);
+    const size_t off = head % SPECTATE_RING_SIZE;
+    const size_t first = my_min (n, SPECTATE_RING_SIZE - off);
+
+    if (SPECTATE_RING_SIZE - (head - tail) < n)
+        return false;
+
+    memcpy (ring + off, data, first);
+    memcpy (ring, (const unsigned char *)data + first, n - first);
+    atomic_store_explicit (&ring_head, head + n, memory_order_release);
+    if (head == tail)
+        SDL_SemPost (ring_sem);
+    return true;
+}
+
+static void
+record_board (void)
+{
+    buf_put_u32 (&scratch, SDL_GetTicks () - start_ticks);
+    wire_put_board (&scratch, board, board_x, board_y);
+    last_game_over = false;
+}
+
+static void
+record_delta (const size_t *changes, size_t n)
+{
+    buf_put_u32 (&scratch, SDL_GetTicks () - start_ticks);
+    wire_put_delta (&scratch, board, changes, n);
+    last_game_over = board->game_over;
+}
+
+static void
+flush_records (void)
+{
+    if (!ring_push (scratch.data, scratch.len))
+        resync = true;
+    scratch.len = 0;
+}
+
+// Replace everything that was dropped by a snapshot of the board. While
+// the writer still sends the last one, the records are dropped as well.
+static bool
+send_snapshot (void)
+{
+    size_t *changed, n;
+
+    if (!resync)
+        return false;
+    if (atomic_load_explicit (&snapshot_ready, memory_order_acquire))
+        return true;
+
+    n = wire_board_changes (board, &changed);
+    record_board ();
+    record_delta (changed, n);
+    free (changed);
+
+    resync = false;
+    if (!ring_push (scratch.data, scratch.len)) {
+        snapshot = scratch;
+        snapshot_pos = atomic_load_explicit (&ring_head, memory_order_relaxed);
+        memset (&scratch, 0, sizeof scratch);
+        atomic_store_explicit (&snapshot_ready, true, memory_order_release);
+        SDL_SemPost (ring_sem);
+    }
+    scratch.len = 0;
+    return true;
+}
+
+void
+spectate_board (int first_x, int first_y)
+{
+    if (!atomic_load (&active))
+        return;
+
+    board_x = first_x;
+    board_y = first_y;
+    if (send_snapshot ())
+        return;
+
+    record_board ();
+    flush_records ();
+}
+
+void
+spectate_delta (const size_t *changes, size_t n)
+{
+    if (!atomic_load (&active) || send_snapshot ())
+        return;
+    if (n == 0 && board->game_over == last_game_over)
+        return;
+
+    record_delta (changes, n);
+    flush_records ();
+}
+
+static int
+open_output (const char *path)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    int fd;
+
+    if (stat (path, &st) == 0 && S_ISSOCK (st.st_mode)) {
+        if (strlen (path) >= sizeof addr.sun_path) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        memset (&addr, 0, sizeof addr);
+        addr.sun_family = AF_UNIX;
+        strcpy (addr.sun_path, path);
+
+        fd = socket (AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect (fd, (struct sockaddr *)&addr, sizeof addr) != 0) {
+            const int err = errno;
+            close (fd);
+            errno = err;
+            return -1;
+        }
+        return fd;
+    }
+
+    // Opening a FIFO fails with ENXIO, while nobody is reading it.
+    return open (path, O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK, 0644);
+}
+
+// Write up to `n` bytes, returns how many were written, or -1 once the stream ends.
+static ssize_t
+write_some (const void *data, size_t n)
+{
+    const ssize_t r = write (out_fd, data, n);
+
+    if (r >= 0)
+        return r;
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        // Don't wait for a stalled consumer on exit.
+        if (atomic_load (&quit_requested))
+            return -1;
+        struct pollfd pfd = { .fd = out_fd, .events = POLLOUT };
+        poll (&pfd, 1, POLL_MS);
+        return 0;
+    }
+    if (errno == EINTR)
+        return 0;
+    fprintf (stderr, "Spectator stream closed: %s\n", strerror (errno));
+    return -1;
+}
+
+static int
+writer_thread (void *arg)
+{
+    (void)arg;
+
+    // Buffer everything until a reader opens the FIFO.
+    while (out_fd < 0) {
+        if (atomic_load (&quit_requested))
+            goto end;
+        out_fd = open_output (out_path);
+        if (out_fd < 0 && errno != ENXIO) {
+            fprintf (stderr, "Failed to open '%s': %s\n", out_path, strerror (errno));
+            goto end;
+        }
+        if (out_fd < 0)
+            SDL_Delay (POLL_MS);
+    }
+
+    while (true) {
+        const size_t tail = atomic_load_explicit (&ring_tail, memory_order_relaxed);
+        const bool pending = atomic_load_explicit (&snapshot_ready, memory_order_acquire);
+        const size_t head = pending ? snapshot_pos : atomic_load_explicit (&ring_head, memory_order_acquire);
+        const size_t off = tail % SPECTATE_RING_SIZE;
+        ssize_t n;
+
+        // The ring is written up to a pending snapshot, then the snapshot.
+        if (pending && tail == snapshot_pos) {
+            if ((n = write_some (snapshot.data + snapshot_sent, snapshot.len - snapshot_sent)) < 0)
+                break;
+            snapshot_sent += n;
+            if (snapshot_sent == snapshot.len) {
+                buf_free (&snapshot);
+                snapshot_sent = 0;
+                atomic_store_explicit (&snapshot_ready, false, memory_order_release);
+            }
+            continue;
+        }
+
+        if (head == tail) {
+            if (atomic_load (&quit_requested))
+                break;
+            SDL_SemWaitTimeout (ring_sem, POLL_MS);
+            continue;
+        }
+
+        if ((n = write_some (ring + off, my_min (head - tail, SPECTATE_RING_SIZE - off))) < 0)
+            break;
+        atomic_store_explicit (&ring_tail, tail + n, memory_order_release);
+    }
+
+end:
+    atomic_store (&active, false);
+    return 0;
+}
+
+bool
+spectate_out (const char *path)
+{
+    out_path = path;
+    out_fd = open_output (path);
+    if (out_fd < 0 && errno != ENXIO) {
+        printf ("Failed to open '%s': %s\n", path, strerror (errno));
+        return false;
+    }
+    if (out_fd >= 0 && !set_nonblock (out_fd)) {
+        perror ("fcntl()");
+        return false;
+    }
+
+    ring = malloc (SPECTATE_RING_SIZE);
+    ring_sem = SDL_CreateSemaphore (0);
+    if (!ring || !ring_sem) {
+        puts ("Failed to create the spectator stream.");
+        return false;
+    }
+    mem_account (MEM_BUFFERS, SPECTATE_RING_SIZE);
+
+    // A closed consumer must not kill the game.
+    signal (SIGPIPE, SIG_IGN);
+
+    start_ticks = SDL_GetTicks ();
+    put_header (&scratch);
+    flush_records ();
+
+    // The first published frame sends the whole board.
+    resync = true;
+    atomic_store (&active, true);
+    return true;
+}
+
+// Read what is available; returns 0 at the end of the stream.
+static ssize_t
+read_more (void)
+{
+    buf_reserve (&in, 4096);
+    const ssize_t n = read (in_fd, in.data + in.len, in.cap - in.len);
+    if (n > 0)
+        in.len += n;
+    return n;
+}
+
+// Get the next complete record from `in`, returns its size or 0.
+static size_t
+next_record (Uint32 *time_ms, enum msg_type *type, const unsigned char **payload, size_t *len, bool *error)
+{
+    const struct buffer msg = { in.data + 4, in.len - 4, in.cap - 4 };
+    size_t n;
+
+    if (in.len < 4 || !(n = msg_next (&msg, type, payload, len, error)))
+        return 0;
+
+    *time_ms = get_u32 (in.data);
+    return n + 4;
+}
+
+static bool
+handle_record (enum msg_type type, const unsigned char *payload, size_t len)
+{
+    struct game_cmd cmd = { 0 };
+
+    switch (type) {
+    case MSG_BOARD:
+        cmd.type = GAME_CMD_REMOTE_BOARD;
+        cmd.data = wire_get_board (payload, len);
+        break;
+    case MSG_DELTA:
+        cmd.type = GAME_CMD_REMOTE_DELTA;
+        cmd.data = wire_get_delta (payload, len);
+        break;
+    default:
+        return true;
+    }
+
+    if (!cmd.data)
+        return false;
+    game_queue (&cmd);
+    return true;
+}
+
+static int
+reader_thread (void *arg)
+{
+    (void)arg;
+
+    while (!atomic_load (&quit_requested)) {
+        const unsigned char *payload;
+        enum msg_type type;
+        bool error = false;
+        Uint32 time_ms;
+        size_t len, n;
+
+        n = next_record (&time_ms, &type, &payload, &len, &error);
+        if (error) {
+            fputs ("Invalid spectator stream.\n", stderr);
+            break;
+        }
+
+        if (n == 0) {
+            struct pollfd pfd = { .fd = in_fd, .events = POLLIN };
+            if (poll (&pfd, 1, POLL_MS) <= 0)
+                continue;
+
+            const ssize_t r = read_more ();
+            if (r == 0) {
+                puts ("Spectator stream ended.");
+                break;
+            } else if (r < 0 && errno != EINTR && errno != EAGAIN) {
+                perror ("read()");
+                break;
+            }
+            continue;
+        }
+
+        // Replay the records at the pace they were recorded.
+        const Sint32 delay = (Sint32)(base_ticks + time_ms - SDL_GetTicks ());
+        if (delay > 0) {
+            SDL_Delay (my_min (delay, POLL_MS));
+            continue;
+        }
+
+        if (!handle_record (type, payload, len)) {
+            fputs ("Invalid record in the spectator stream.\n", stderr);
+            break;
+        }
+        buf_consume (&in, n);
+    }
+    return 0;
+}
+
+bool
+spectate_in (const char *path)
+{
+    struct buffer header = { 0 };
+    const unsigned char *payload;
+    enum msg_type type;
+    bool error = false;
+    Uint32 time_ms;
+    size_t len, n;
+    bool valid;
+
+    in_fd = strcmp (path, "-") == 0 ? STDIN_FILENO : open (path, O_RDONLY);
+    if (in_fd < 0) {
+        printf ("Failed to open '%s': %s\n", path, strerror (errno));
+        return false;
+    }
+
+    // Wait for the first board, so the window can be set up for it.
+    put_header (&header);
+    while (in.len < header.len) {
+        if (read_more () <= 0)
+            break;
+    }
+    valid = in.len >= header.len && memcmp (in.data, header.data, header.len) == 0;
+    if (valid)
+        buf_consume (&in, header.len);
+    buf_free (&header);
+    if (!valid) {
+        printf ("'%s' is not a spectator stream.\n", path);
+        return false;
+    }
+
+    while (!(n = next_record (&time_ms, &type, &payload, &len, &error))) {
+        if (error || read_more () <= 0) {
+            printf ("Failed to receive the board from '%s'.\n", path);
+            return false;
+        }
+    }
+    if (type != MSG_BOARD || !(first_board = wire_get_board (payload, len))) {
+        printf ("Invalid board received from '%s'.\n", path);
+        return false;
+    }
+    buf_consume (&in, n);
+    base_ticks = -time_ms;
+
+    default_width = first_board->width;
+    default_height = first_board->height;
+    default_n_mines = first_board->n_mines;
+    spectating = true;
+    return true;
+}
+
+bool
+spectate_start (void)
+{
+    if (spectating) {
+        const struct game_cmd cmd = { .type = GAME_CMD_REMOTE_BOARD, .data = first_board };
+        first_board = NULL;
+        game_queue (&cmd);
+        base_ticks += SDL_GetTicks ();
+        reader = SDL_CreateThread (&reader_thread, "spectate-in", NULL);
+        if (!reader) {
+            printf ("Failed to create spectator thread: %s\n", SDL_GetError ());
+            return false;
+        }
+    }
+    if (atomic_load (&active)) {
+        writer = SDL_CreateThread (&writer_thread, "spectate-out", NULL);
+        if (!writer) {
+            printf ("Failed to create spectator thread: %s\n", SDL_GetError ());
+            return false;
+        }
+    }
+    return true;
+}
+
+// The game thread may still publish, so the ring and `scratch` stay allocated.
+void
+spectate_quit (void)
+{
+    atomic_store (&quit_requested, true);
+    if (reader) {
+        SDL_WaitThread (reader, NULL);
+        reader = NULL;
+    }
+    if (writer) {
+        SDL_SemPost (ring_sem);
+        SDL_WaitThread (writer, NULL);
+        writer = NULL;
+    }
+
+    atomic_store (&active, false);
+    if (atomic_load (&snapshot_ready)) {
+        buf_free (&snapshot);
+        atomic_store (&snapshot_ready, false);
+    }
+    if (out_fd >= 0)
+        close (out_fd);
+    if (in_fd > STDIN_FILENO)
+        close (in_fd);
+    out_fd = in_fd = -1;
+    buf_free (&in);
+    free (first_board);
+    first_board = NULL;
+}
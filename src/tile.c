@@ -14,221 +14,99 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
-#include <assert.h>
-#include <stdlib.h>
-#include <string.h>
-#include <stdio.h>
 #include "video.h"
 #include "tile.h"
 #include "util.h"
 #include "bsw.h"
 
-struct tile *tiles = NULL;
-int n_bombs, n_selected;
-bool generated = false;
-
-struct tile *
-get_tile (int x, int y)
-{
-    return (x >= 0 && x < t_width && y >= 0 && y < t_height)
-           ? &tiles [y * t_width + x] : NULL;
-}
-
-bool
-tile_is_bomb (int x, int y)
+unsigned char
+tile_view (const struct tile *t)
 {
-    const struct tile *t;
-    return (t = get_tile (x, y)) != NULL && t->is_bomb;
-}
-
-void
-reset_tiles (void)
-{
-    memset (tiles, 0, sizeof (struct tile) * t_width * t_height);
-    generated = false;
-}
-void
-generate_tiles (int nx, int ny)
-{
-    memset (tiles, 0, sizeof (struct tile) * t_width * t_height);
-
-    int nb = default_n_mines;
-    n_bombs = nb;
-    n_selected = 0;
-
-    // Create bombs.
-    while (nb > 0) {
-        struct tile *t;
-        int x, y;
-
-        x = rrand (0, t_width - 1);
-        y = rrand (0, t_height - 1);
-        t = get_tile (x, y);
-        assert (t != NULL);
-
-        if (t->is_bomb || (x == nx && y == ny))
-            continue;
-
-        t->is_bomb = true;
-        --nb;
-    }
-
-    // Count bombs and initialize tile positions.
-    for (int y = 0; y < t_height; ++y) {
-        for (int x = 0; x < t_width; ++x) {
-            struct tile *t;
-
-            t = get_tile (x, y);
-            assert (t != NULL);
-
-            t->x = x;
-            t->y = y;
-
-            for (unsigned i = 0; i < 9; ++i) {
-                const int dx = x + (-1 + (i / 3));
-                const int dy = y + (-1 + (i % 3));
-                t->n_bombs += tile_is_bomb (dx, dy);
-            }
-        }
-    }
-    generated = true;
-    start_time = time (NULL);
+    return t->status | (t->is_bomb ? TILE_VIEW_BOMB : 0) | (t->n_bombs << 3);
 }
 
-bool
-init_tiles (void)
-{
-    free (tiles);
-    tiles = malloc (default_width * default_height * sizeof (struct tile));
-    if (!tiles) {
-        perror ("malloc()");
-        return false;
-    }
-
-    t_width = default_width;
-    t_height = default_height;
-    reset_tiles ();
-
-    return true;
-}
+// Background and glyph of every sprite in the composited tile atlas.
+static const struct {
+    SDL_Point bg, fg;
+} sprite_parts[N_TILE_SPRITES] = {
+    [SPRITE_HIDDEN]  = { {  0, 16 }, {   0, 16 } },
+    [SPRITE_MARKED]  = { {  0, 16 }, {  64, 16 } },
+    [SPRITE_MARKED2] = { {  0, 16 }, { 146, 16 } },
+    [SPRITE_BOMB]    = { {  0, 16 }, {  32, 16 } },
+    [SPRITE_MINE]    = { {  0, 16 }, {  48, 16 } },
+    [SPRITE_0]       = { { 16, 16 }, {   0,  0 } },
+    [SPRITE_0 + 1]   = { { 16, 16 }, {  16,  0 } },
+    [SPRITE_0 + 2]   = { { 16, 16 }, {  32,  0 } },
+    [SPRITE_0 + 3]   = { { 16, 16 }, {  48,  0 } },
+    [SPRITE_0 + 4]   = { { 16, 16 }, {  64,  0 } },
+    [SPRITE_0 + 5]   = { { 16, 16 }, {  80,  0 } },
+    [SPRITE_0 + 6]   = { { 16, 16 }, {  96,  0 } },
+    [SPRITE_0 + 7]   = { { 16, 16 }, { 112,  0 } },
+    [SPRITE_0 + 8]   = { { 16, 16 }, { 128,  0 } },
+};
+
+unsigned char tile_sprite_lut[2][256];
 
 static void
-select_tile (struct tile *t)
+init_sprite_lut (void)
 {
-    if (t->status == TILE_CLICKED)
-        return;
-    t->status = TILE_CLICKED;
-    if (!t->is_bomb)
-        ++n_selected;
-}
+    for (unsigned v = 0; v < 256; ++v) {
+        enum tile_sprite spr;
 
-static void
-expand_tile (struct tile *t, bool initial)
-{
-    if (!t || t->is_bomb || (!initial && t->status == TILE_CLICKED))
-        return;
-    select_tile (t);
-    if (t->n_bombs == 0) {
-        expand_tile (get_tile (t->x - 1, t->y - 1), false);
-        expand_tile (get_tile (t->x    , t->y - 1), false);
-        expand_tile (get_tile (t->x + 1, t->y - 1), false);
-        expand_tile (get_tile (t->x - 1, t->y    ), false);
-        expand_tile (get_tile (t->x + 1, t->y    ), false);
-        expand_tile (get_tile (t->x - 1, t->y + 1), false);
-        expand_tile (get_tile (t->x    , t->y + 1), false);
-        expand_tile (get_tile (t->x + 1, t->y + 1), false);
-    }
-}
-
-void
-tile_click (struct tile *t, int which)
-{
-    switch (which) {
-    case SDL_BUTTON_LEFT:
-        select_tile (t);
-        if (t->is_bomb) {
-            game_over = true;
-            end_time = time (NULL);
-            if (haptic) {
-                SDL_HapticRumblePlay (haptic, 0.3f, 500);
-            }
-        } else {
-            expand_tile (t, true);
-        }
-
-        if (all_selected ()) {
-            game_over = true;
-            end_time = time (NULL);
-        }
-        render ();
-        break;
-    case SDL_BUTTON_RIGHT:
-        switch (t->status) {
+        switch (tile_view_status (v)) {
         case TILE_NONE:
-            t->status = TILE_MARKED;
+            spr = SPRITE_HIDDEN;
             break;
         case TILE_MARKED:
-            t->status = TILE_MARKED2;
+            spr = SPRITE_MARKED;
             break;
         case TILE_MARKED2:
-            t->status = TILE_NONE;
+            spr = SPRITE_MARKED2;
             break;
         case TILE_CLICKED:
+        default:
+            spr = (v & TILE_VIEW_BOMB) ? SPRITE_BOMB : SPRITE_0 + my_min (tile_view_count (v), 8u);
             break;
         }
-        render ();
-        break;
+
+        tile_sprite_lut[0][v] = spr;
+        tile_sprite_lut[1][v] = (v & TILE_VIEW_BOMB) && tile_view_status (v) != TILE_CLICKED ? SPRITE_MINE : spr;
     }
 }
 
-void
-tile_draw (const struct tile *t, const SDL_Rect *rect)
+SDL_Surface *
+tile_compose (SDL_Surface *graphics)
 {
-    SDL_Rect srect, bgrect;
-
-    srect.w = 16;
-    srect.h = 16;
-
-    bgrect.x = 0;
-    bgrect.y = 16;
-    bgrect.w = 16;
-    bgrect.h = 16;
-
-    switch (t->status) {
-    case TILE_NONE:
-        srect.x = 0;
-        srect.y = 16;
-        break;
-    case TILE_MARKED:
-        srect.x = 64;
-        srect.y = 16;
-        break;
-    case TILE_MARKED2:
-        srect.x = 146;
-        srect.y = 16;
-        break;
-    case TILE_CLICKED:
-        if (t->is_bomb) {
-            srect.x = 32;
-            srect.y = 16;
-        } else {
-            bgrect.x = 16;
-
-            srect.x = t->n_bombs * 16;
-            srect.y = 0;
-        }
-        break;
+    SDL_Surface *atlas;
+
+    atlas = SDL_CreateRGBSurfaceWithFormat (0, N_TILE_SPRITES * 16, 16, 32, SDL_PIXELFORMAT_RGBA32);
+    if (!atlas)
+        return NULL;
+
+    for (int i = 0; i < N_TILE_SPRITES; ++i) {
+        SDL_Rect bgrect = { sprite_parts[i].bg.x, sprite_parts[i].bg.y, 16, 16 };
+        SDL_Rect srect = { sprite_parts[i].fg.x, sprite_parts[i].fg.y, 16, 16 };
+        SDL_Rect drect = { i * 16, 0, 16, 16 };
+
+        // Render background tile.
+        SDL_SetSurfaceBlendMode (graphics, SDL_BLENDMODE_NONE);
+        SDL_BlitSurface (graphics, &bgrect, atlas, &drect);
+
+        // Render actual tile.
+        drect.x = i * 16;
+        drect.y = 0;
+        SDL_SetSurfaceBlendMode (graphics, SDL_BLENDMODE_BLEND);
+        SDL_BlitSurface (graphics, &srect, atlas, &drect);
     }
 
-    // Render background tile.
-    SDL_RenderCopy (renderer, sprite, &bgrect, rect);
+    init_sprite_lut ();
+    return atlas;
+}
 
-    if (game_over && t->is_bomb && t->status != TILE_CLICKED) {
-        srect.x = 48;
-        srect.y = 16;
-    }
+void
+tile_draw (unsigned char view, bool show_mines, const SDL_Rect *rect)
+{
+    const SDL_Rect srect = { tile_view_sprite (view, show_mines) * 16, 0, 16, 16 };
 
-    // Render actual tile.
-    SDL_RenderCopy (renderer, sprite, &srect, rect);
+    SDL_RenderCopy (renderer, tile_sprite, &srect, rect);
 }
-
@@ -14,13 +14,15 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <sys/resource.h> // setrlimit()
 #include <sys/stat.h>   // mkdir()
-#include <stdlib.h>     // rand(), malloc(), abort()
+#include <stdlib.h>     // rand(), rand_r(), malloc(), abort()
 #include <limits.h>     // PATH_MAX
 #include <unistd.h>     // readlink()
 #include <libgen.h>     // dirname()
 #include <string.h>     // strchr(), strcmp()
 #include <stdio.h>      // perror()
+#include <time.h>       // clock_gettime()
 #include "util.h"
 
 int
@@ -88,3 +90,22 @@ mkdir_p (char *dir)
 
     mkdir (dir, 0755);
 }
+
+uint64_t
+monotonic_ms (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void
+raise_file_limit (void)
+{
+    struct rlimit lim;
+
+    if (getrlimit (RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max) {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit (RLIMIT_NOFILE, &lim);
+    }
+}
@@ -15,25 +15,66 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <SDL2/SDL_image.h>
-#include <assert.h>
 #include "dialog.h"
+#include "heatmap.h"
 #include "config.h"
+#include "export.h"
 #include "video.h"
+#include "game.h"
 #include "menu.h"
 #include "tile.h"
 #include "util.h"
+#include "mem.h"
 #include "bsw.h"
 
 SDL_Haptic *haptic;
+SDL_Texture *tile_sprite;
+
+// The software renderer has its own fast path, which copies pre-scaled
+// tiles straight into the pixels of a streaming texture.
+static bool soft_render = false;
+static SDL_Surface *soft_atlas;             // The tile atlas in the format of `soft_target`.
+static SDL_Surface *soft_scaled;            // `soft_atlas` scaled to the current tile size.
+static SDL_Texture *soft_target;            // Streaming texture covering the window.
+static int soft_target_w, soft_target_h;
+
+// The board is drawn into `frame`, so that the HUD can be updated every
+// second without drawing the tiles again. Without render targets, every
+// update draws the whole window.
+static bool frame_supported = false;
+static SDL_Texture *frame;
+static int frame_w, frame_h;
+static struct board_view frame_view;       // Copy of the view `frame` shows; only its counters are used.
+static bool frame_valid = false;
+static SDL_TimerID tick_timerID;
+static _Atomic uint64_t tick_start;         // start_ms of the view the timer is running for.
 float t_offX, t_offY, t_size;
 int w_width, w_height;
+Uint64 last_render;
 bool shift_pressed = false;
 
+// Memory of a texture or surface, assuming 4 bytes per pixel for textures.
+static ptrdiff_t
+texture_size (SDL_Texture *texture)
+{
+    int w = 0, h = 0;
+
+    if (texture)
+        SDL_QueryTexture (texture, NULL, NULL, &w, &h);
+    return (ptrdiff_t)w * h * 4;
+}
+
+static ptrdiff_t
+surface_size (const SDL_Surface *surface)
+{
+    return surface ? (ptrdiff_t)surface->pitch * surface->h : 0;
+}
+
 bool
 video_init ()
 {
     SDL_RendererInfo renderInfo;
-    SDL_Surface *surface;
+    SDL_Surface *surface, *atlas;
     char *path_surface;
 
     // Prefer Wayland by default, if SDL2 >= 2.0.22
@@ -76,6 +117,8 @@ video_init ()
         SDL_Quit ();
         return false;
     }
+    SDL_GetRendererInfo (renderer, &renderInfo);
+    frame_supported = (renderInfo.flags & SDL_RENDERER_TARGETTEXTURE) != 0;
 
     // Create a haptic device.
     haptic = SDL_HapticOpen (0);
@@ -107,7 +150,31 @@ video_init ()
         SDL_Quit ();
         return false;
     }
+
+    // Pre-composite the tiles, so each tile takes only a single copy.
+    atlas = tile_compose (surface);
     SDL_FreeSurface (surface);
+    if (atlas)
+        export_init (atlas);
+    tile_sprite = atlas ? SDL_CreateTextureFromSurface (renderer, atlas) : NULL;
+    if (!tile_sprite) {
+        printf ("Failed to create tile atlas: %s\n", SDL_GetError ());
+        SDL_FreeSurface (atlas);
+        SDL_DestroyTexture (sprite);
+        SDL_DestroyRenderer (renderer);
+        SDL_DestroyWindow (window);
+        IMG_Quit ();
+        SDL_Quit ();
+        return false;
+    }
+
+    // Keep a copy of the atlas for the software fast path.
+    if (renderInfo.flags & SDL_RENDERER_SOFTWARE) {
+        soft_atlas = SDL_ConvertSurfaceFormat (atlas, SDL_PIXELFORMAT_ARGB8888, 0);
+        soft_render = soft_atlas != NULL;
+    }
+    SDL_FreeSurface (atlas);
+    mem_account (MEM_TEXTURES, texture_size (sprite) + texture_size (tile_sprite) + surface_size (soft_atlas));
 
     // Set the window icon.
     path_surface = relative_path (MSW_ICON);
@@ -125,7 +192,6 @@ video_init ()
     SDL_SetWindowMinimumSize (window, 150, 100);
 
     // Print information about the.
-    SDL_GetRendererInfo (renderer, &renderInfo);
     printf ("Renderer: %s\n", renderInfo.name);
     return true;
 }
@@ -133,6 +199,13 @@ video_init ()
 void
 video_quit (void)
 {
+    if (tick_timerID)
+        SDL_RemoveTimer (tick_timerID);
+    SDL_DestroyTexture (frame);
+    SDL_DestroyTexture (soft_target);
+    SDL_FreeSurface (soft_scaled);
+    SDL_FreeSurface (soft_atlas);
+    SDL_DestroyTexture (tile_sprite);
     SDL_DestroyTexture (sprite);
     SDL_DestroyRenderer (renderer);
     SDL_DestroyWindow (window);
@@ -143,11 +216,13 @@ video_quit (void)
 void
 video_post_init (void)
 {
+    const struct board_view *v = game_view ();
+
     SDL_GetWindowSize (window, &w_width, &w_height);
 
-    t_size = my_min (w_width / t_width, w_height / t_height);
-    t_offX = (float)(w_width - (t_width * t_size)) / t_size / 2;
-    t_offY = (float)(w_height - (t_height * t_size)) / t_size / 2;
+    t_size = my_min (w_width / v->width, w_height / v->height);
+    t_offX = (float)(w_width - (v->width * t_size)) / t_size / 2;
+    t_offY = (float)(w_height - (v->height * t_size)) / t_size / 2;
 }
 
 void
@@ -190,8 +265,32 @@ menu_draw_xint (unsigned value, unsigned len, int x0, int y0, int w, int h)
     }
 }
 
+// Show the 3BV, 3BV/s and efficiency of a won game in a row below the text.
+static void
+draw_rating (const struct board_view *v, int y0)
+{
+    const int w = w_width / 2 / 13, h = w_height / 12;
+    const int x0 = (w_width - 13 * w) / 2, dot = my_max (w / 6, 2);
+    const uint64_t ms = my_max (v->end_ms - v->start_ms, 1);
+    SDL_Rect rect;
+
+    menu_draw_int (my_min (v->bbbv, 9999), 4, x0, y0, w, h);
+
+    // 3BV/s with two decimal places.
+    menu_draw_int (my_min (v->bbbv * 100000 / ms, 9999), 4, x0 + 5 * w, y0, w, h);
+    rect.x = x0 + 7 * w - dot / 2;
+    rect.y = y0 + h - 2 * dot;
+    rect.w = rect.h = dot;
+    SDL_SetRenderDrawColor (renderer, 0, 0, 0, 255);
+    SDL_RenderFillRect (renderer, &rect);
+
+    // Efficiency in percent; co-op clients don't know the clicks.
+    if (v->n_clicks != 0)
+        menu_draw_int (my_min (v->bbbv * 100 / v->n_clicks, 999), 3, x0 + 10 * w, y0, w, h);
+}
+
 static void
-draw_text (int idx)
+draw_text (const struct board_view *v, int idx)
 {
     SDL_Rect srect, drect;
 
@@ -206,47 +305,332 @@ draw_text (int idx)
     drect.y = (w_height - drect.h) / 2;
 
     SDL_RenderCopy (renderer, sprite, &srect, &drect);
+    if (idx == 1)
+        draw_rating (v, drect.y + drect.h + w_height / 40);
 
     drect.y += 9 * drect.h / 16;
     drect.h = w_height / 8;
 
-    menu_draw_int (end_time - start_time, 4, drect.x + drect.x * 2 / 17, drect.y, drect.w * 2 / 9, drect.h);
+    menu_draw_int ((v->end_ms - v->start_ms) / 1000, 4, drect.x + drect.x * 2 / 17, drect.y, drect.w * 2 / 9, drect.h);
+}
+
+// Compute the range of tiles that are visible in the window.
+static void
+visible_tiles (const struct board_view *v, int ts, int ox, int oy, SDL_Rect *range)
+{
+    if (ts <= 0) {
+        range->x = range->y = range->w = range->h = 0;
+        return;
+    }
+
+    range->x = my_max (0, -ox / ts);
+    range->y = my_max (0, -oy / ts);
+    range->w = my_min (v->width, (w_width - ox + ts - 1) / ts) - range->x;
+    range->h = my_min (v->height, (w_height - oy + ts - 1) / ts) - range->y;
 }
 
 void
-render_tiles (void)
+render_tiles (const struct board_view *v)
 {
     const int ts = t_size;
     const int ox = t_offX * ts, oy = t_offY * ts;
-    for (int y = 0; y < t_height; ++y) {
-        for (int x = 0; x < t_width; ++x) {
-            struct tile *t;
-            SDL_Rect rect;
+    SDL_Rect range;
 
-            t = get_tile (x, y);
-            assert (t != NULL);
+    visible_tiles (v, ts, ox, oy, &range);
+    for (int y = range.y; y < range.y + range.h; ++y) {
+        for (int x = range.x; x < range.x + range.w; ++x) {
+            SDL_Rect rect;
 
             rect.x = ox + (x * ts);
             rect.y = oy + (y * ts);
             rect.w = ts;
             rect.h = ts;
 
-            tile_draw (t, &rect);
+            tile_draw (v->tiles[(size_t)y * v->width + x], v->game_over, &rect);
+        }
+    }
+}
+
+// Make sure the scaled atlas and the streaming texture are up to date.
+static bool
+soft_prepare (int ts)
+{
+    if (ts <= 0)
+        return false;
+
+    if (!soft_scaled || soft_scaled->h != ts) {
+        mem_account (MEM_TEXTURES, -surface_size (soft_scaled));
+        SDL_FreeSurface (soft_scaled);
+        soft_scaled = SDL_CreateRGBSurfaceWithFormat (0, N_TILE_SPRITES * ts, ts, 32, SDL_PIXELFORMAT_ARGB8888);
+        if (!soft_scaled)
+            return false;
+        mem_account (MEM_TEXTURES, surface_size (soft_scaled));
+
+        // Scale each sprite on its own, to keep the edges exact.
+        SDL_SetSurfaceBlendMode (soft_atlas, SDL_BLENDMODE_NONE);
+        for (int i = 0; i < N_TILE_SPRITES; ++i) {
+            SDL_Rect srect = { i * 16, 0, 16, 16 };
+            SDL_Rect drect = { i * ts, 0, ts, ts };
+            SDL_BlitScaled (soft_atlas, &srect, soft_scaled, &drect);
+        }
+    }
+
+    if (!soft_target || soft_target_w != w_width || soft_target_h != w_height) {
+        mem_account (MEM_TEXTURES, -texture_size (soft_target));
+        SDL_DestroyTexture (soft_target);
+        soft_target = SDL_CreateTexture (renderer, SDL_PIXELFORMAT_ARGB8888,
+                                         SDL_TEXTUREACCESS_STREAMING, w_width, w_height);
+        if (!soft_target)
+            return false;
+        mem_account (MEM_TEXTURES, texture_size (soft_target));
+        soft_target_w = w_width;
+        soft_target_h = w_height;
+    }
+    return true;
+}
+
+static void
+render_tiles_soft (const struct board_view *v)
+{
+    const int ts = t_size;
+    const int ox = t_offX * ts, oy = t_offY * ts;
+    const Uint32 bg = 0xff000000 | (default_color.r << 16) | (default_color.g << 8) | default_color.b;
+    SDL_Rect range;
+    Uint8 *pixels;
+    int pitch;
+
+    if (SDL_LockTexture (soft_target, NULL, (void **)&pixels, &pitch) != 0)
+        return;
+
+    // Clear the background.
+    for (int x = 0; x < w_width; ++x)
+        ((Uint32 *)pixels)[x] = bg;
+    for (int y = 1; y < w_height; ++y)
+        memcpy (pixels + y * pitch, pixels, w_width * sizeof (Uint32));
+
+    // Copy the visible part of each tile, one row of pixels at a time.
+    visible_tiles (v, ts, ox, oy, &range);
+    for (int y = range.y; y < range.y + range.h; ++y) {
+        const unsigned char *row = &v->tiles[(size_t)y * v->width];
+        const int py = oy + y * ts;
+        const int r0 = my_max (0, -py), r1 = my_min (ts, w_height - py);
+
+        for (int r = r0; r < r1; ++r) {
+            Uint32 *dst = (Uint32 *)(pixels + (py + r) * pitch);
+            const Uint32 *src = (const Uint32 *)((const Uint8 *)soft_scaled->pixels + r * soft_scaled->pitch);
+
+            for (int x = range.x; x < range.x + range.w; ++x) {
+                const int px = ox + x * ts;
+                const int c0 = my_max (0, -px), c1 = my_min (ts, w_width - px);
+                const int spr = tile_view_sprite (row[x], v->game_over);
+
+                memcpy (dst + px + c0, src + spr * ts + c0, (c1 - c0) * sizeof (Uint32));
+            }
         }
     }
+
+    SDL_UnlockTexture (soft_target);
+    SDL_RenderCopy (renderer, soft_target, NULL, NULL);
+}
+
+// Show the progress of clearing or generating a large board.
+static void
+render_progress (int permille)
+{
+    SDL_Rect rect;
+
+    rect.w = w_width / 2;
+    rect.h = my_max (w_height / 40, 8);
+    rect.x = (w_width - rect.w) / 2;
+    rect.y = (w_height - rect.h) / 2;
+
+    SDL_SetRenderDrawColor (renderer, 32, 32, 32, 255);
+    SDL_RenderFillRect (renderer, &rect);
+    SDL_SetRenderDrawColor (renderer, 255, 255, 255, 255);
+    SDL_RenderDrawRect (renderer, &rect);
+
+    rect.x += 2;
+    rect.y += 2;
+    rect.h -= 4;
+    rect.w = (rect.w - 4) * permille / 1000;
+    SDL_SetRenderDrawColor (renderer, 0, 192, 0, 255);
+    SDL_RenderFillRect (renderer, &rect);
+}
+
+// Tint every hidden tile from green to red by its mine probability.
+static void
+render_heatmap (const struct board_view *v)
+{
+    const int ts = t_size;
+    const int ox = t_offX * ts, oy = t_offY * ts;
+    const float *prob;
+    SDL_Rect range;
+
+    prob = heatmap_lock (v->width, v->height);
+    if (!prob) {
+        heatmap_unlock ();
+        return;
+    }
+
+    SDL_SetRenderDrawBlendMode (renderer, SDL_BLENDMODE_BLEND);
+    visible_tiles (v, ts, ox, oy, &range);
+    for (int y = range.y; y < range.y + range.h; ++y) {
+        for (int x = range.x; x < range.x + range.w; ++x) {
+            const size_t i = (size_t)y * v->width + x;
+            const SDL_Rect rect = { ox + x * ts, oy + y * ts, ts, ts };
+
+            if (prob[i] < 0.0f || tile_view_status (v->tiles[i]) == TILE_CLICKED)
+                continue;
+
+            SDL_SetRenderDrawColor (renderer, prob[i] * 255, (1.0f - prob[i]) * 255, 0, 112);
+            SDL_RenderFillRect (renderer, &rect);
+        }
+    }
+    SDL_SetRenderDrawBlendMode (renderer, SDL_BLENDMODE_NONE);
+    heatmap_unlock ();
+}
+
+// (Re-)create `frame`, if it doesn't match the window.
+static bool
+frame_prepare (void)
+{
+    if (!frame_supported)
+        return false;
+    if (frame && frame_w == w_width && frame_h == w_height)
+        return true;
+
+    mem_account (MEM_TEXTURES, -texture_size (frame));
+    SDL_DestroyTexture (frame);
+    frame = SDL_CreateTexture (renderer, SDL_PIXELFORMAT_ARGB8888,
+                               SDL_TEXTUREACCESS_TARGET, w_width, w_height);
+    if (!frame) {
+        printf ("Failed to create frame texture: %s\n", SDL_GetError ());
+        frame_supported = false;
+        return false;
+    }
+    mem_account (MEM_TEXTURES, texture_size (frame));
+    frame_w = w_width;
+    frame_h = w_height;
+    return true;
+}
+
+static unsigned
+count_digits (uint64_t n)
+{
+    unsigned len = 1;
+    for (; n >= 10; n /= 10)
+        ++len;
+    return len;
+}
+
+static bool
+hud_shown (const struct board_view *v)
+{
+    return !v->game_over && !menu.shown && !dialog_is_open;
+}
+
+// Draw the remaining mines in the top-left and the time in the top-right corner.
+static void
+render_hud (const struct board_view *v)
+{
+    const uint64_t mines = v->n_bombs > v->n_flagged ? v->n_bombs - v->n_flagged : 0;
+    const unsigned mine_len = my_clamp (count_digits (v->n_bombs), 3, 9);
+    const int h = my_clamp (w_height / 16, 16, 48), w = h * 3 / 4, m = h / 4;
+    unsigned seconds = 0;
+
+    if (v->generated)
+        seconds = ((v->game_over ? v->end_ms : monotonic_ms ()) - v->start_ms) / 1000;
+
+    menu_draw_int (mines, mine_len, m, m, w, h);
+    menu_draw_int (seconds, 4, w_width - m - 4 * w, m, w, h);
+}
+
+static Uint32
+cb_tick (Uint32 interval, void *arg)
+{
+    (void)interval;
+    (void)arg;
+
+    SDL_Event e;
+    SDL_zero (e);
+    e.user.type = SDL_USEREVENT;
+    e.user.code = EV_TICK;
+    SDL_PushEvent (&e);
+
+    // Tick when the next second of the game begins.
+    return 1000 - (monotonic_ms () - tick_start) % 1000;
+}
+
+// Run the timer while a game is in progress.
+static void
+update_timer (const struct board_view *v)
+{
+    const bool running = v->generated && !v->game_over;
+
+    if (running && tick_timerID && tick_start == v->start_ms)
+        return;
+
+    if (tick_timerID) {
+        SDL_RemoveTimer (tick_timerID);
+        tick_timerID = 0;
+    }
+    if (running) {
+        tick_start = v->start_ms;
+        tick_timerID = SDL_AddTimer (1000 - (monotonic_ms () - v->start_ms) % 1000, &cb_tick, NULL);
+    }
+}
+
+// Show the frame and the HUD on top of it.
+static void
+present (const struct board_view *v)
+{
+    if (frame_valid)
+        SDL_RenderCopy (renderer, frame, NULL, NULL);
+    if (hud_shown (v))
+        render_hud (v);
+    SDL_RenderPresent (renderer);
+    update_timer (v);
+}
+
+void
+render_tick (void)
+{
+    // Only the HUD changes, so the cached frame can be shown again.
+    if (!frame_valid) {
+        render ();
+    } else if (hud_shown (&frame_view)) {
+        present (&frame_view);
+    }
 }
 
 void
 render (void)
 {
+    const struct board_view *v = game_view ();
+    const bool cached = frame_prepare ();
+
+    if (cached)
+        SDL_SetRenderTarget (renderer, frame);
+
     // Clear the background.
     SDL_SetRenderDrawColor (renderer, default_color.r, default_color.g, default_color.b, 255);
     SDL_RenderClear (renderer);
 
-    render_tiles ();
+    if (soft_render && soft_prepare (t_size)) {
+        render_tiles_soft (v);
+    } else {
+        render_tiles (v);
+    }
 
-    if (game_over)
-        draw_text (all_selected () ? 1 : 2);
+    if (heatmap_shown () && !v->game_over)
+        render_heatmap (v);
+
+    if (v->game_over)
+        draw_text (v, view_all_selected (v) ? 1 : 2);
+
+    const int permille = game_progress ();
+    if (permille >= 0)
+        render_progress (permille);
 
     if (menu.shown)
         menu_draw ();
@@ -254,6 +638,11 @@ render (void)
     if (dialog_is_open)
         dialog_draw ();
 
-    SDL_RenderPresent (renderer);
+    if (cached)
+        SDL_SetRenderTarget (renderer, NULL);
+    frame_view = *v;
+    frame_valid = cached;
+    present (v);
+    last_render = SDL_GetPerformanceCounter ();
 }
 
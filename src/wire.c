@@ -0,0 +1,269 @@
+/*
+ * Copyright (C) 2022 Benjamin Stürz
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "board.h"
+#include "wire.h"
+#include "util.h"
+#include "mem.h"
+
+void
+buf_reserve (struct buffer *b, size_t n)
+{
+    if (b->len + n <= b->cap)
+        return;
+
+    const size_t cap = my_max (b->cap * 2, b->len + n);
+    unsigned char *data = realloc (b->data, cap);
+    if (!data) {
+        perror ("realloc()");
+        abort ();
+    }
+    mem_account (MEM_BUFFERS, cap - b->cap);
+    b->data = data;
+    b->cap = cap;
+}
+
+void
+buf_put (struct buffer *b, const void *data, size_t n)
+{
+    buf_reserve (b, n);
+    memcpy (b->data + b->len, data, n);
+    b->len += n;
+}
+
+void
+buf_put_u8 (struct buffer *b, uint8_t v)
+{
+    buf_put (b, &v, 1);
+}
+
+void
+buf_put_u32 (struct buffer *b, uint32_t v)
+{
+    const unsigned char data[4] = { v >> 24, v >> 16, v >> 8, v };
+    buf_put (b, data, sizeof data);
+}
+
+void
+buf_put_u64 (struct buffer *b, uint64_t v)
+{
+    buf_put_u32 (b, v >> 32);
+    buf_put_u32 (b, v);
+}
+
+void
+buf_put_varint (struct buffer *b, uint64_t v)
+{
+    buf_reserve (b, 10);
+    while (v >= 0x80) {
+        b->data[b->len++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    b->data[b->len++] = v;
+}
+
+void
+buf_consume (struct buffer *b, size_t n)
+{
+    memmove (b->data, b->data + n, b->len - n);
+    b->len -= n;
+}
+
+void
+buf_free (struct buffer *b)
+{
+    mem_account (MEM_BUFFERS, -(ptrdiff_t)b->cap);
+    free (b->data);
+    b->data = NULL;
+    b->len = b->cap = 0;
+}
+
+uint32_t
+get_u32 (const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+uint64_t
+get_u64 (const unsigned char *p)
+{
+    return ((uint64_t)get_u32 (p) << 32) | get_u32 (p + 4);
+}
+
+size_t
+msg_begin (struct buffer *b, enum msg_type type)
+{
+    const size_t pos = b->len;
+    buf_put_u8 (b, type);
+    buf_put_u32 (b, 0);
+    return pos;
+}
+
+void
+msg_end (struct buffer *b, size_t pos)
+{
+    const uint32_t len = b->len - pos - MSG_HEADER_SIZE;
+    const unsigned char data[4] = { len >> 24, len >> 16, len >> 8, len };
+    memcpy (b->data + pos + 1, data, sizeof data);
+}
+
+size_t
+msg_next (const struct buffer *b, enum msg_type *type, const unsigned char **payload, size_t *len, bool *error)
+{
+    if (b->len < MSG_HEADER_SIZE)
+        return 0;
+
+    *type = b->data[0];
+    *len = get_u32 (b->data + 1);
+    if (*len > MSG_MAX_SIZE) {
+        *error = true;
+        return 0;
+    }
+    if (b->len < MSG_HEADER_SIZE + *len)
+        return 0;
+
+    *payload = b->data + MSG_HEADER_SIZE;
+    return MSG_HEADER_SIZE + *len;
+}
+
+void
+wire_put_board (struct buffer *b, const struct bsw_board *board, int first_x, int first_y)
+{
+    const size_t pos = msg_begin (b, MSG_BOARD);
+
+    buf_put_u32 (b, board->width);
+    buf_put_u32 (b, board->height);
+    buf_put_u64 (b, board->n_bombs);
+    buf_put_u32 (b, board->seed);
+    buf_put_u8 (b, board->generated);
+    buf_put_u32 (b, first_x);
+    buf_put_u32 (b, first_y);
+    msg_end (b, pos);
+}
+
+static int
+cmp_size (const void *a, const void *b)
+{
+    const size_t x = *(const size_t *)a, y = *(const size_t *)b;
+    return (x > y) - (x < y);
+}
+
+void
+wire_put_delta (struct buffer *b, const struct bsw_board *board, const size_t *changes, size_t n)
+{
+    size_t *sorted, prev = 0, pos;
+
+    sorted = malloc (n * sizeof (size_t) + 1);
+    if (!sorted) {
+        perror ("malloc()");
+        abort ();
+    }
+    memcpy (sorted, changes, n * sizeof (size_t));
+    qsort (sorted, n, sizeof (size_t), &cmp_size);
+
+    pos = msg_begin (b, MSG_DELTA);
+    buf_put_u8 (b, board->game_over);
+    for (size_t i = 0; i < n; ++i) {
+        if (i > 0 && sorted[i] == sorted[i - 1])
+            continue;
+        buf_put_varint (b, ((uint64_t)(sorted[i] - prev) << 2) | board->tiles[sorted[i]].status);
+        prev = sorted[i];
+    }
+    msg_end (b, pos);
+    free (sorted);
+}
+
+size_t
+wire_board_changes (const struct bsw_board *board, size_t **changes)
+{
+    const size_t n_tiles = bsw_count (board);
+    size_t *changed = NULL, n = 0, cap = 0;
+
+    for (size_t i = 0; i < n_tiles; ++i) {
+        if (board->tiles[i].status == TILE_NONE)
+            continue;
+        if (n == cap) {
+            cap = cap ? cap * 2 : 256;
+            size_t *new_changed = realloc (changed, cap * sizeof (size_t));
+            if (!new_changed) {
+                perror ("realloc()");
+                abort ();
+            }
+            changed = new_changed;
+        }
+        changed[n++] = i;
+    }
+
+    *changes = changed;
+    return n;
+}
+
+struct net_board *
+wire_get_board (const unsigned char *p, size_t len)
+{
+    struct net_board *board;
+
+    if (len < 29 || !(board = malloc (sizeof *board)))
+        return NULL;
+
+    board->width = get_u32 (p);
+    board->height = get_u32 (p + 4);
+    board->n_mines = get_u64 (p + 8);
+    board->seed = get_u32 (p + 16);
+    board->generated = p[20];
+    board->first_x = (int32_t)get_u32 (p + 21);
+    board->first_y = (int32_t)get_u32 (p + 25);
+    return board;
+}
+
+struct net_delta *
+wire_get_delta (const unsigned char *p, size_t len)
+{
+    struct net_delta *delta;
+    size_t n = 0, index = 0;
+
+    if (len < 1)
+        return NULL;
+
+    // Every byte without the continuation bit ends a varint.
+    for (size_t i = 1; i < len; ++i)
+        n += !(p[i] & 0x80);
+
+    delta = malloc (sizeof *delta + n * sizeof *delta->tiles);
+    if (!delta)
+        return NULL;
+    delta->game_over = p[0];
+    delta->n = 0;
+
+    for (size_t i = 1; i < len && delta->n < n; ) {
+        uint64_t v = 0;
+        for (unsigned shift = 0; i < len && shift < 64; shift += 7) {
+            const unsigned char b = p[i++];
+            v |= (uint64_t)(b & 0x7f) << shift;
+            if (!(b & 0x80))
+                break;
+        }
+        index += v >> 2;
+        delta->tiles[delta->n].index = index;
+        delta->tiles[delta->n].status = v & 0x03;
+        ++delta->n;
+    }
+    return delta;
+}